@@ -0,0 +1,68 @@
+#include "arena.h"
+
+static thread_local Arena* thread_arena = nullptr;
+static thread_local int thread_scopes = 0;
+
+Arena::Arena(std::size_t blockSize)
+    : block(0), used(0), blockSize(blockSize)
+{
+}
+
+void* Arena::allocate(std::size_t bytes, std::size_t alignment)
+{
+    while (true)
+    {
+        if (block < blocks.size())
+        {
+            // Round up to the alignment
+            const std::size_t start = (used + alignment - 1)/alignment*alignment;
+
+            if (start + bytes <= blocks[block].size)
+            {
+                used = start + bytes;
+                return blocks[block].data.get() + start;
+            }
+
+            // Doesn't fit, try the next block
+            if (block+1 < blocks.size())
+            {
+                ++block;
+                used = 0;
+                continue;
+            }
+        }
+
+        // Out of blocks, new[] is aligned for any fundamental type
+        blocks.push_back(Block(std::max(blockSize, bytes)));
+        block = blocks.size()-1;
+        used = 0;
+    }
+}
+
+void Arena::reset()
+{
+    block = 0;
+    used = 0;
+}
+
+Arena* Arena::current()
+{
+    return (thread_scopes > 0)?thread_arena:nullptr;
+}
+
+ArenaScope::ArenaScope()
+{
+    // Created on first use and freed when the thread exits
+    static thread_local Arena arena;
+
+    thread_arena = &arena;
+    ++thread_scopes;
+}
+
+ArenaScope::~ArenaScope()
+{
+    --thread_scopes;
+
+    if (thread_scopes == 0)
+        thread_arena->reset();
+}
@@ -0,0 +1,130 @@
+/*
+ * A per-thread monotonic arena for the many small, short-lived allocations
+ * made while analyzing a page (outlines, bubbles, label sets). Allocating is
+ * bumping a pointer, freeing does nothing, and all of it is released at once
+ * when the page is done. Since each thread has its own, threads don't contend
+ * in the allocator.
+ *
+ * Containers using ArenaAllocator allocate from the arena if they were
+ * created while an ArenaScope is active on this thread and from the heap
+ * otherwise, so they're safe to use anywhere. Just don't keep ones created
+ * during a scope past the end of it.
+ *
+ * Example:
+ *
+ *   {
+ *       ArenaScope scope;
+ *       ArenaVector<Coord> path; // from the arena
+ *       ...
+ *   } // everything allocated is released
+ */
+
+#ifndef H_ARENA
+#define H_ARENA
+
+#include <set>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <functional>
+
+#include "options.h"
+
+class Arena
+{
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+
+        Block(std::size_t size)
+            : data(new char[size]), size(size)
+        {
+        }
+    };
+
+    // We keep all the blocks on reset() so the next page doesn't allocate
+    std::vector<Block> blocks;
+    std::size_t block;
+    std::size_t used;
+    const std::size_t blockSize;
+
+public:
+    Arena(std::size_t blockSize = ARENA_BLOCK);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(std::size_t bytes, std::size_t alignment);
+
+    // Make all of the memory available again
+    void reset();
+
+    // This thread's arena if an ArenaScope is active, otherwise nullptr
+    static Arena* current();
+
+    friend class ArenaScope;
+};
+
+// Use this thread's arena till this goes out of scope. When the outermost
+// scope ends, everything allocated from it is released.
+class ArenaScope
+{
+public:
+    ArenaScope();
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+};
+
+template<class T> class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    // Where to allocate from, or the heap if nullptr
+    Arena* arena;
+
+    ArenaAllocator()
+        : arena(Arena::current())
+    {
+    }
+
+    template<class U> ArenaAllocator(const ArenaAllocator<U>& other)
+        : arena(other.arena)
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        if (arena)
+            return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T)));
+
+        return static_cast<T*>(::operator new(n*sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        // Arena memory is released all at once
+        if (!arena)
+            ::operator delete(p);
+    }
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena == b.arena;
+}
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena != b.arena;
+}
+
+template<class T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+template<class T> using ArenaSet = std::set<T, std::less<T>, ArenaAllocator<T>>;
+
+#endif
@@ -0,0 +1,285 @@
+#include <cctype>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "read.h"
+#include "options.h"
+#include "processor.h"
+
+// Part after the last slash
+static std::string basename(const std::string& path)
+{
+    const std::string::size_type slash = path.find_last_of('/');
+    return (slash == std::string::npos)?path:path.substr(slash+1);
+}
+
+// The comma-separated cells of a CSV row from Processor::csv()
+static std::vector<std::string> cells(const std::string& line)
+{
+    std::vector<std::string> result;
+    std::string::size_type start = 0;
+
+    while (true)
+    {
+        const std::string::size_type comma = line.find(',', start);
+        result.push_back(line.substr(start, comma - start));
+
+        if (comma == std::string::npos)
+            break;
+
+        start = comma + 1;
+
+        if (start < line.size() && line[start] == ' ')
+            ++start;
+    }
+
+    return result;
+}
+
+bool isScan(const std::string& filename)
+{
+    const std::string::size_type dot = filename.find_last_of('.');
+
+    if (dot == std::string::npos)
+        return false;
+
+    std::string ext = filename.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    return ext == ".pdf" || ext == ".tif" || ext == ".tiff" ||
+        ext == ".png" || ext == ".jpg" || ext == ".jpeg";
+}
+
+void addPath(std::vector<BatchForm>& forms, const std::string& path,
+        long long key)
+{
+    struct stat info;
+
+    if (stat(path.c_str(), &info) != 0)
+        throw std::runtime_error("couldn't find " + path);
+
+    if (!(info.st_mode&S_IFDIR))
+    {
+        forms.push_back(BatchForm(path, key));
+        return;
+    }
+
+    DIR* d = opendir(path.c_str());
+
+    if (!d)
+        throw std::runtime_error("couldn't open directory " + path);
+
+    std::vector<std::string> filenames;
+
+    while (dirent* entry = readdir(d))
+        if (isScan(entry->d_name))
+            filenames.push_back(entry->d_name);
+
+    closedir(d);
+
+    // So the output is in a predictable order
+    std::sort(filenames.begin(), filenames.end());
+
+    const std::string prefix = (path.back() == '/')?path:path + "/";
+
+    for (const std::string& filename : filenames)
+        forms.push_back(BatchForm(prefix + filename, key));
+}
+
+void readManifest(std::vector<BatchForm>& forms, const std::string& manifest)
+{
+    std::ifstream file(manifest);
+
+    if (!file.is_open())
+        throw std::runtime_error("couldn't open manifest " + manifest);
+
+    const std::string::size_type slash = manifest.find_last_of('/');
+    const std::string dir = (slash == std::string::npos)?"":manifest.substr(0, slash+1);
+
+    std::string line;
+    int number = 0;
+
+    while (std::getline(file, line))
+    {
+        ++number;
+
+        // Trim whitespace
+        const std::string::size_type start = line.find_first_not_of(" \t\r");
+        const std::string::size_type end = line.find_last_not_of(" \t\r");
+
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+
+        line = line.substr(start, end-start+1);
+
+        // The key is the last thing on the line so the filename can have
+        // spaces
+        const std::string::size_type split = line.find_last_of(" \t");
+        long long key = DefaultID;
+
+        try
+        {
+            if (split != std::string::npos)
+                key = std::stoll(line.substr(split+1));
+        }
+        catch (const std::logic_error&)
+        {
+        }
+
+        if (key == DefaultID)
+            throw std::runtime_error("invalid key ID on line " +
+                    std::to_string(number) + " of " + manifest);
+
+        std::string filename = line.substr(0, line.find_last_not_of(" \t", split)+1);
+
+        if (filename[0] != '/')
+            filename = dir + filename;
+
+        addPath(forms, filename, key);
+    }
+}
+
+BatchOutput::BatchOutput(bool csv, const std::string& dir, std::ostream& out,
+        bool combined)
+    : csv(csv), combined(combined), dir(dir), out(out), first(true)
+{
+}
+
+std::string BatchOutput::createOutput(const std::string& name)
+{
+    const std::string prefix = ((dir.back() == '/')?dir:dir + "/") + name;
+    const std::string ext = csv?".csv":".txt";
+
+    // Only one of us can create each name, even other processes
+    for (int i = 1; i < 1000; ++i)
+    {
+        const std::string filename = (i == 1)?prefix + ext:
+            prefix + "-" + std::to_string(i) + ext;
+        const int fd = open(filename.c_str(), O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+
+        if (fd >= 0)
+        {
+            close(fd);
+
+            if (i > 1)
+            {
+                std::unique_lock<std::mutex> lck(lock);
+                std::cerr << "Warning: " << prefix + ext << " already exists, "
+                    "writing to " << filename << std::endl;
+            }
+
+            return filename;
+        }
+
+        if (errno != EEXIST)
+            break;
+    }
+
+    return "";
+}
+
+void BatchOutput::write(Processor& p, Form& form, const std::string& name)
+{
+    const std::string results = csv?p.csv(form):p.print(form);
+
+    // Each to its own file
+    if (!dir.empty())
+    {
+        const std::string filename = createOutput(name.empty()?
+                basename(form.filename):name);
+        std::ofstream file;
+
+        if (!filename.empty())
+            file.open(filename);
+
+        // We're on one of the worker threads, so just say so rather than
+        // stopping the rest of the forms
+        if (!file.is_open())
+        {
+            std::unique_lock<std::mutex> lck(lock);
+            std::cerr << "Error: couldn't write results of " << form.filename
+                << " to " << dir << std::endl;
+            return;
+        }
+
+        file << results;
+        return;
+    }
+
+    std::unique_lock<std::mutex> lck(lock);
+
+    if (!combined)
+    {
+        out << results;
+    }
+    else if (csv)
+    {
+        // Each form only has columns for the questions in its key, so put
+        // them all under one header with a column for every question
+        if (first)
+        {
+            out << "File, ID, Score";
+
+            for (int q = 1; q <= Q_TOTAL; ++q)
+                out << ", " << q;
+
+            out << std::endl;
+        }
+
+        std::istringstream in(results);
+        std::string line;
+        std::vector<int> questions;
+
+        if (std::getline(in, line))
+        {
+            const std::vector<std::string> header = cells(line);
+
+            for (std::vector<std::string>::size_type i = 2; i < header.size(); ++i)
+                questions.push_back(std::atoi(header[i].c_str()));
+        }
+
+        // Say which PDF each row came from
+        while (std::getline(in, line))
+        {
+            const std::vector<std::string> row = cells(line);
+            std::vector<std::string> answers(Q_TOTAL);
+
+            for (std::vector<std::string>::size_type i = 2;
+                    i < row.size() && i-2 < questions.size(); ++i)
+                if (questions[i-2] >= 1 && questions[i-2] <= Q_TOTAL)
+                    answers[questions[i-2]-1] = row[i];
+
+            // Leave off the empty cells at the end
+            while (!answers.empty() && answers.back().empty())
+                answers.pop_back();
+
+            out << basename(form.filename);
+
+            for (std::vector<std::string>::size_type i = 0; i < 2 && i < row.size(); ++i)
+                out << ", " << row[i];
+
+            for (const std::string& answer : answers)
+                out << ", " << answer;
+
+            out << std::endl;
+        }
+    }
+    else
+    {
+        if (!first)
+            out << std::endl;
+
+        out << "==> " << form.filename << " <==" << std::endl << results;
+    }
+
+    out.flush();
+    first = false;
+}
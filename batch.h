@@ -0,0 +1,90 @@
+/*
+ * Grading many forms from the command line at once, e.g. every section of a
+ * class. All the forms go through one Processor so that the pages of all of
+ * them share the same threads, and each form's results are written out as
+ * soon as it's done.
+ *
+ * Example:
+ *
+ *   std::vector<BatchForm> forms;
+ *   addPath(forms, "section1.pdf", key);
+ *   addPath(forms, "sections/", key);
+ *   readManifest(forms, "manifest.txt");
+ *
+ *   BatchOutput output(csv, "results/");
+ *   p.onFinish([&output, &p](Form& f) { output.write(p, f); });
+ */
+
+#ifndef H_BATCH
+#define H_BATCH
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "forms.h"
+
+class Processor;
+
+// A PDF to grade and the ID of the form in it that is the key
+struct BatchForm
+{
+    std::string filename;
+    long long key;
+
+    BatchForm(const std::string& filename, long long key)
+        : filename(filename), key(key)
+    {
+    }
+};
+
+// Whether the extension is that of a PDF or a scan saved as a TIFF, PNG, or
+// JPEG
+bool isScan(const std::string& filename);
+
+// Add a PDF or all the PDFs, TIFFs, PNGs, and JPEGs in a directory (sorted by
+// name) using this key.
+// Throws if it doesn't exist.
+void addPath(std::vector<BatchForm>& forms, const std::string& path,
+        long long key);
+
+// Add the forms listed in a manifest, one per line, each the filename followed
+// by whitespace and the key ID. Blank lines and lines starting with # are
+// ignored. Relative filenames are relative to the manifest's directory.
+// Throws if it can't be read or a line is invalid.
+void readManifest(std::vector<BatchForm>& forms, const std::string& manifest);
+
+// Write each form's results as it finishes, either all to one stream or each
+// to its own file in a directory
+class BatchOutput
+{
+    const bool csv;
+    const bool combined;
+    const std::string dir;
+    std::ostream& out;
+
+    // Forms finish on the worker threads
+    std::mutex lock;
+    bool first;
+
+public:
+    // If dir is empty, write everything to out. When combining the CSV output,
+    // there's one header with a column for every question, and each row starts
+    // with the PDF's filename and has its answers under their questions.
+    BatchOutput(bool csv, const std::string& dir = "",
+            std::ostream& out = std::cout, bool combined = true);
+
+    // Results written to dir are named after the form's file unless given
+    // another name, e.g. the one the scan was moved to
+    void write(Processor& p, Form& form, const std::string& name = "");
+
+private:
+    // Create the file in dir for this form's results, e.g.
+    // dir/section1.pdf.csv, or dir/section1.pdf-2.csv if there's already one,
+    // such as from another form named section1.pdf or an earlier run, so
+    // results are never overwritten. Returns an empty string if it couldn't.
+    std::string createOutput(const std::string& name);
+};
+
+#endif
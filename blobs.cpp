@@ -1,8 +1,8 @@
-#include <set>
 #include <array>
 #include <algorithm>
 
 #include "log.h"
+#include "pool.h"
 #include "blobs.h"
 
 const int Blobs::default_label = 0;
@@ -15,6 +15,8 @@ Blobs::Blobs(Blobs&& other)
 
 Blobs& Blobs::operator=(Blobs&& other)
 {
+    BufferPool<int>::local().put(std::move(labels));
+
     w = other.w;
     h = other.h;
     set = std::move(other.set);
@@ -24,12 +26,17 @@ Blobs& Blobs::operator=(Blobs&& other)
     return *this;
 }
 
+Blobs::~Blobs()
+{
+    BufferPool<int>::local().put(std::move(labels));
+}
+
 Blobs::Blobs(const Pixels& img)
     : set(default_label)
 {
     w = img.width();
     h = img.height();
-    labels = std::vector<std::vector<int>>(h, std::vector<int>(w, default_label));
+    labels = BufferPool<int>::local().get(w*h, default_label);
 
     int next_label = default_label+1;
 
@@ -61,11 +68,12 @@ Blobs::Blobs(const Pixels& img)
                 // around us and knowing if two are different.
                 int count = 0;
                 bool different = false;
-                std::vector<int> equivalent_labels;
 
                 // We will have at most four since the current pixel takes on
-                // the label of one of these 4 surrounding pixels
-                equivalent_labels.reserve(4);
+                // the label of one of these 4 surrounding pixels, so don't
+                // allocate for these
+                std::array<int, 4> equivalent_labels;
+                int equivalent = 0;
 
                 for (const Coord& p : points)
                 {
@@ -73,14 +81,14 @@ Blobs::Blobs(const Pixels& img)
                     {
                         if (count == 0)
                         {
-                            labels[y][x] = labels[p.y][p.x];
+                            labels[y*w + x] = labels[p.y*w + p.x];
                         }
                         // Detect when we have multiple black pixels around us
                         // with different labels
-                        else if (labels[y][x] != labels[p.y][p.x])
+                        else if (labels[y*w + x] != labels[p.y*w + p.x])
                         {
                             different = true;
-                            equivalent_labels.push_back(labels[p.y][p.x]);
+                            equivalent_labels[equivalent++] = labels[p.y*w + p.x];
                         }
 
                         ++count;
@@ -91,7 +99,7 @@ Blobs::Blobs(const Pixels& img)
                 if (count == 0)
                 {
                     // New label for a potentially new object
-                    labels[y][x] = next_label;
+                    labels[y*w + x] = next_label;
                     set.add(next_label);
 
                     ++next_label;
@@ -100,8 +108,8 @@ Blobs::Blobs(const Pixels& img)
                 else if (count > 1 && different)
                 {
                     // Save that these are all equivalent to the current one
-                    for (int label : equivalent_labels)
-                        set.join(labels[y][x], label);
+                    for (int i = 0; i < equivalent; ++i)
+                        set.join(labels[y*w + x], equivalent_labels[i]);
                 }
                 // Otherwise: One neighbor black or multiple but all same label,
                 // and we already set the current pixel's label
@@ -115,7 +123,7 @@ Blobs::Blobs(const Pixels& img)
         for (int x = 0; x < w; ++x)
         {
             const Coord point(x, y);
-            int currentLabel = labels[y][x];
+            int currentLabel = labels[y*w + x];
 
             if (currentLabel != default_label)
             {
@@ -123,7 +131,7 @@ Blobs::Blobs(const Pixels& img)
 
                 if (repLabel != set.notfound())
                 {
-                    labels[y][x] = repLabel;
+                    labels[y*w + x] = repLabel;
 
                     // If not found, add this object
                     if (objs.find(repLabel) == objs.end())
@@ -145,29 +153,29 @@ int Blobs::label(const Coord& p) const
 {
     if (p.x >= 0 && p.x < w &&
         p.y >= 0 && p.y < h)
-        return labels[p.y][p.x];
+        return labels[p.y*w + p.x];
     else
         return default_label;
 }
 
-std::vector<Coord> Blobs::in(const Coord& p1, const Coord& p2) const
+ArenaVector<Coord> Blobs::in(const Coord& p1, const Coord& p2) const
 {
-    std::set<int> used_labels;
-    std::vector<Coord> subset;
+    ArenaSet<int> used_labels;
+    ArenaVector<Coord> subset;
 
     for (int y = p1.y; y < p2.y; ++y)
     {
         for (int x = p1.x; x < p2.x; ++x)
         {
-            if (labels[y][x] != default_label &&
-                    used_labels.find(labels[y][x]) == used_labels.end())
+            if (labels[y*w + x] != default_label &&
+                    used_labels.find(labels[y*w + x]) == used_labels.end())
             {
-                const std::map<int, CoordPair>::const_iterator obj = objs.find(labels[y][x]);
+                const std::map<int, CoordPair>::const_iterator obj = objs.find(labels[y*w + x]);
 
                 if (obj != objs.end())
                 {
                     subset.push_back(obj->second.first);
-                    used_labels.insert(labels[y][x]);
+                    used_labels.insert(labels[y*w + x]);
                 }
                 else
                 {
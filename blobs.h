@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "data.h"
+#include "arena.h"
 #include "pixels.h"
 #include "maputils.h"
 #include "disjointset.h"
@@ -41,20 +42,22 @@ private:
     int h = 0;
     DisjointSet<int> set;
     std::map<int, CoordPair> objs;
-    std::vector<std::vector<int>> labels;
+    std::vector<int> labels; // Row by row, w*h
 
 public:
     Blobs(const Pixels& img);
     int label(const Coord& p) const;
     CoordPair object(int label) const;
 
-    // Allow moving
+    // Allow moving, moving or destroying gives the labels back to this
+    // thread's BufferPool
     Blobs(Blobs&&);
     Blobs& operator=(Blobs&& other);
+    ~Blobs();
 
     // Get all first points that have part of the object in the rectangle
     // around p1 and p2 (with p1 to the left and above p2).
-    std::vector<Coord> in(const Coord& p1, const Coord& p2) const;
+    ArenaVector<Coord> in(const Coord& p1, const Coord& p2) const;
 
     // Get all the first points of the label within a rectangle around
     // the points p1 and p2. This assumes that p2 is down and to the right
@@ -54,7 +54,7 @@ Box::Box(Pixels& img, const Blobs& blobs, const Coord& point)
     if (!shape.good())
         return;
 
-    const std::vector<Coord>& outline = shape.points();
+    const ArenaVector<Coord>& outline = shape.points();
 
     // Find the four corners by finding the four farthest points from each other.
     // Note that we'll use the square versions of these, since this is a box
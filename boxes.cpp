@@ -6,29 +6,31 @@
 #include "boxes.h"
 #include "options.h"
 
-// Find all the boxes in the image
-std::vector<Coord> findBoxes(Pixels& img, const Blobs& blobs, Data& data)
+// A solid black rectangle lined up with the pixels, from (x1,y1) up to but not
+// including (x2,y2)
+class AlignedBox
 {
-    typedef std::vector<Coord>::size_type size_type;
-
-    std::vector<Box> boxes;
-    std::vector<Coord> coords;
+    int x1, y1, x2, y2;
 
-    for (const CoordPair& pair : blobs)
-    {
-        // This may be the height, width, or diagonal
-        double dist = distance(pair.first, pair.last);
+public:
+    AlignedBox(int x1, int y1, int x2, int y2)
+        :x1(x1), y1(y1), x2(x2), y2(y2) { }
 
-        // Get rid of most the really big or really small objects
-        if (dist > MIN_HEIGHT && dist < MAX_DIAG)
-        {
-            Box box(img, blobs, pair.first);
+    // Same as Box, measured between the corner pixels
+    inline int width() const  { return x2-1 - x1; }
+    inline int height() const { return y2-1 - y1; }
+    inline int diagonal() const { return std::ceil(std::sqrt(width()*width() + height()*height())); }
+    inline Coord midpoint() const { return findMidpoint(Coord(x1, y1), Coord(x2-1, y2-1)); }
+};
 
-            if (box.valid())
-                boxes.push_back(box);
-        }
-    }
+// Ignore the boxes above the huge jump, e.g. the one by the name, and return
+// the midpoints of the rest, remembering the size of the first one
+template<class T>
+static std::vector<Coord> belowJump(const std::vector<T>& boxes, Data& data)
+{
+    typedef typename std::vector<T>::size_type size_type;
 
+    std::vector<Coord> coords;
     bool found = false;
     size_type jump = 0;
 
@@ -56,3 +58,130 @@ std::vector<Coord> findBoxes(Pixels& img, const Blobs& blobs, Data& data)
 
     return coords;
 }
+
+// Find all the boxes in the image
+std::vector<Coord> findBoxes(Pixels& img, const Blobs& blobs, Data& data)
+{
+    std::vector<Box> boxes;
+
+    for (const CoordPair& pair : blobs)
+    {
+        // This may be the height, width, or diagonal
+        double dist = distance(pair.first, pair.last);
+
+        // Get rid of most the really big or really small objects
+        if (dist > MIN_HEIGHT && dist < MAX_DIAG)
+        {
+            Box box(img, blobs, pair.first);
+
+            if (box.valid())
+                boxes.push_back(box);
+        }
+    }
+
+    return belowJump(boxes, data);
+}
+
+// Whether the pixels from x1 to x2 (not including x2) in row y are all white.
+// Outside the image is white.
+static bool white(const Pixels& img, int x1, int x2, int y)
+{
+    for (int x = x1; x < x2; ++x)
+        if (img.black(Coord(x, y)))
+            return false;
+
+    return true;
+}
+
+// Whether row y is black exactly from x1 to x2 (not including x2)
+static bool exactRun(const Pixels& img, int x1, int x2, int y)
+{
+    if (img.black(Coord(x1-1, y)) || img.black(Coord(x2, y)))
+        return false;
+
+    for (int x = x1; x < x2; ++x)
+        if (!img.black(Coord(x, y)))
+            return false;
+
+    return true;
+}
+
+std::vector<Coord> findAlignedBoxes(const Pixels& img, Data& data)
+{
+    typedef std::vector<Coord>::size_type size_type;
+
+    const int w = img.width();
+    const int h = img.height();
+
+    // Widths of boxes with diagonals in the allowed range
+    const double diagonalPerWidth = std::sqrt(1 + 1/(ASPECT*ASPECT));
+    const int min_width = std::floor(MIN_DIAG/diagonalPerWidth);
+    const int max_width = std::ceil(MAX_DIAG/diagonalPerWidth);
+
+    std::vector<AlignedBox> boxes;
+    int misses = 0;
+
+    // Look at each run of black in each row that could be the top edge of a
+    // box. In raster order like the blobs, so the boxes are in the same order
+    // findBoxes() would give them.
+    for (int y = 1; y < h; ++y)
+    {
+        int x = 0;
+
+        while (x < w)
+        {
+            if (!img.black(Coord(x, y)))
+            {
+                ++x;
+                continue;
+            }
+
+            const int x1 = x;
+
+            while (x < w && img.black(Coord(x, y)))
+                ++x;
+
+            const int x2 = x;
+
+            if (x2 - x1 < min_width || x2 - x1 > max_width ||
+                !white(img, x1-1, x2+1, y-1))
+                continue;
+
+            // Every row the same down to a white one
+            int y2 = y + 1;
+
+            while (y2 < h && y2 - y <= max_width && exactRun(img, x1, x2, y2))
+                ++y2;
+
+            const AlignedBox box(x1, y, x2, y2);
+            const double approx_height = box.width()/ASPECT;
+
+            // On a scanned page, give up after the first few instead of
+            // going over the whole page
+            if (white(img, x1-1, x2+1, y2) &&
+                box.height() >= approx_height-HEIGHT_ERROR &&
+                box.height() <= approx_height+HEIGHT_ERROR &&
+                box.diagonal() >= MIN_DIAG && box.diagonal() <= MAX_DIAG)
+                boxes.push_back(box);
+            else if (boxes.empty() && ++misses > ALIGNED_MISSES)
+                return std::vector<Coord>();
+        }
+    }
+
+    std::vector<Coord> coords = belowJump(boxes, data);
+
+    if (coords.size() != TOTAL_BOXES)
+        return std::vector<Coord>();
+
+    // The column down the side exactly vertical and the row along the bottom
+    // exactly horizontal, otherwise it's been scanned or rotated
+    for (size_type i = 1; i < BOT_START-1; ++i)
+        if (coords[i].x != coords[0].x)
+            return std::vector<Coord>();
+
+    for (size_type i = BOT_START; i < BOT_END; ++i)
+        if (coords[i].y != coords[BOT_START-1].y)
+            return std::vector<Coord>();
+
+    return coords;
+}
@@ -14,4 +14,11 @@
 // Find boxes in the image returns { Coord(midpoint_x, midpoint_y), ... }
 std::vector<Coord> findBoxes(Pixels& img, const Blobs& blobs, Data& data);
 
+// Find the boxes without labeling the image if they're all solid rectangles
+// lined up exactly with the pixels, as in a computer-generated black and white
+// page. Returns them as findBoxes() does with the bottom row sorted by x, or
+// nothing if the page isn't like that, which for a scanned page we can tell
+// from the first few rows with anything in them.
+std::vector<Coord> findAlignedBoxes(const Pixels& img, Data& data);
+
 #endif
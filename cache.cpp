@@ -0,0 +1,194 @@
+#include <sstream>
+#include <stdexcept>
+
+#include "cache.h"
+
+// Keep track of recently used entries with the time in seconds
+static const std::string NOW = "strftime('%s', 'now')";
+
+Cache::Cache(const std::string& filename, long long maxPdfs, long long maxPages)
+    : initialized(false), maxPdfs(maxPdfs), maxPages(maxPages), inserts(0)
+{
+    if (filename.empty())
+        return;
+
+    std::ostringstream s;
+    s << "sqlite3:db=" << filename;
+    db = cppdb::session(s.str());
+
+    initialize();
+
+    getPageQ = db << "select id, answers from pages where hash = ? limit 1";
+    addPageQ = db << "insert or replace into pages(hash, id, answers, used) values(?, ?, ?, " + NOW + ")";
+    usePageQ = db << "update pages set used = " + NOW + " where hash = ?";
+    prunePagesQ = db << "delete from pages where hash in "
+        "(select hash from pages order by used desc limit -1 offset ?)";
+    getPdfQ = db << "select pages from pdfs where hash = ? limit 1";
+    addPdfQ = db << "insert or replace into pdfs(hash, pages, used) values(?, ?, " + NOW + ")";
+    usePdfQ = db << "update pdfs set used = " + NOW + " where hash = ?";
+    prunePdfsQ = db << "delete from pdfs where hash in "
+        "(select hash from pdfs order by used desc limit -1 offset ?)";
+}
+
+void Cache::initialize()
+{
+    std::unique_lock<std::mutex> lck(lock);
+
+    // Every lookup and parsed page writes to the cache from the processing
+    // threads, so don't wait for each write to be synced to disk. With the
+    // write-ahead log, a crash loses at most the last few entries, which is
+    // fine for a cache.
+    db << "pragma journal_mode=wal" << cppdb::row;
+    db << "pragma synchronous=normal" << cppdb::exec;
+
+    db << "create table if not exists pages ("
+              "hash    text primary key not null,"
+              "id      integer not null,"
+              "answers text not null,"
+              "used    integer not null"
+          ")"
+       << cppdb::exec;
+
+    db << "create table if not exists pdfs ("
+              "hash    text primary key not null,"
+              "pages   text not null,"
+              "used    integer not null"
+          ")"
+       << cppdb::exec;
+
+    db << "create index if not exists pages_used on pages(used)" << cppdb::exec;
+    db << "create index if not exists pdfs_used on pdfs(used)" << cppdb::exec;
+
+    initialized = true;
+}
+
+bool Cache::page(const std::string& hash, CachedPage& page)
+{
+    if (!initialized)
+        return false;
+
+    std::unique_lock<std::mutex> lck(lock);
+
+    getPageQ.bind(1, hash);
+    cppdb::result r = getPageQ.row();
+
+    std::string answers;
+    const bool found = !r.empty();
+
+    if (found)
+    {
+        r.fetch(0, page.id);
+        r.fetch(1, answers);
+    }
+
+    getPageQ.reset();
+
+    if (!found)
+        return false;
+
+    std::istringstream s(answers);
+    int a;
+
+    page.answers.clear();
+
+    while (s >> a)
+        page.answers.push_back(static_cast<Answer>(a));
+
+    usePageQ.bind(1, hash);
+    usePageQ.exec();
+    usePageQ.reset();
+
+    return true;
+}
+
+void Cache::addPage(const std::string& hash, long long id,
+        const std::vector<Answer>& answers)
+{
+    if (!initialized)
+        return;
+
+    std::ostringstream s;
+
+    for (const Answer& a : answers)
+        s << static_cast<int>(a) << " ";
+
+    std::unique_lock<std::mutex> lck(lock);
+
+    addPageQ.bind(1, hash);
+    addPageQ.bind(2, id);
+    addPageQ.bind(3, s.str());
+    addPageQ.exec();
+    addPageQ.reset();
+
+    prune();
+}
+
+bool Cache::pdf(const std::string& hash, std::vector<std::string>& pages)
+{
+    if (!initialized)
+        return false;
+
+    std::unique_lock<std::mutex> lck(lock);
+
+    getPdfQ.bind(1, hash);
+    cppdb::result r = getPdfQ.row();
+
+    std::string list;
+    const bool found = !r.empty();
+
+    if (found)
+        r.fetch(0, list);
+
+    getPdfQ.reset();
+
+    if (!found)
+        return false;
+
+    std::istringstream s(list);
+    std::string page;
+
+    pages.clear();
+
+    while (s >> page)
+        pages.push_back(page);
+
+    usePdfQ.bind(1, hash);
+    usePdfQ.exec();
+    usePdfQ.reset();
+
+    return true;
+}
+
+void Cache::addPdf(const std::string& hash, const std::vector<std::string>& pages)
+{
+    if (!initialized)
+        return;
+
+    std::ostringstream s;
+
+    for (const std::string& page : pages)
+        s << page << " ";
+
+    std::unique_lock<std::mutex> lck(lock);
+
+    addPdfQ.bind(1, hash);
+    addPdfQ.bind(2, s.str());
+    addPdfQ.exec();
+    addPdfQ.reset();
+
+    prune();
+}
+
+void Cache::prune()
+{
+    if (++inserts%CACHE_PRUNE != 0)
+        return;
+
+    prunePagesQ.bind(1, maxPages);
+    prunePagesQ.exec();
+    prunePagesQ.reset();
+
+    prunePdfsQ.bind(1, maxPdfs);
+    prunePdfsQ.exec();
+    prunePdfsQ.reset();
+}
@@ -0,0 +1,96 @@
+/*
+ * Cache of results keyed by a hash of the content so that if the same PDF or
+ * the same page (e.g. the key) is uploaded again, we don't need to decode or
+ * analyze it again.
+ *
+ * There are two levels: the SHA-256 of the whole PDF maps to the hashes of
+ * its pages, and the SHA-256 of each page's raw image stream maps to the ID
+ * and answers found on it. Only the least recently used entries beyond the
+ * size limits are removed. Stored in SQLite, separate from the website's
+ * database.
+ *
+ * Example:
+ *
+ *   Cache cache("cache.db");
+ *   CachedPage page;
+ *   if (cache.page(sha256(data, len), page)) { }
+ *   cache.addPage(sha256(data, len), id, answers);
+ */
+
+#ifndef H_CACHE
+#define H_CACHE
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cppdb/frontend.h>
+
+#include "data.h"
+#include "options.h"
+
+// Results for a page we've seen before
+struct CachedPage
+{
+    long long id;
+    std::vector<Answer> answers;
+
+    CachedPage()
+        : id(-1)
+    {
+    }
+};
+
+class Cache
+{
+    bool initialized;
+    cppdb::session db;
+
+    cppdb::statement getPageQ;
+    cppdb::statement addPageQ;
+    cppdb::statement usePageQ;
+    cppdb::statement prunePagesQ;
+    cppdb::statement getPdfQ;
+    cppdb::statement addPdfQ;
+    cppdb::statement usePdfQ;
+    cppdb::statement prunePdfsQ;
+
+    // Max entries of each type to keep
+    const long long maxPdfs;
+    const long long maxPages;
+
+    // We only prune every so often
+    long long inserts;
+
+    // Only one transaction at a time
+    std::mutex lock;
+
+public:
+    // If the filename is empty, nothing is cached
+    Cache(const std::string& filename = "", long long maxPdfs = CACHE_PDFS,
+            long long maxPages = CACHE_PAGES);
+
+    Cache(const Cache&) = delete;
+    Cache& operator=(const Cache&) = delete;
+
+    bool enabled() const { return initialized; }
+
+    // Look up a page by the hash of its image, returning whether found
+    bool page(const std::string& hash, CachedPage& page);
+    void addPage(const std::string& hash, long long id,
+            const std::vector<Answer>& answers);
+
+    // Look up the hashes of the pages of a PDF by the hash of the PDF,
+    // returning whether found
+    bool pdf(const std::string& hash, std::vector<std::string>& pages);
+    void addPdf(const std::string& hash, const std::vector<std::string>& pages);
+
+private:
+    void initialize();
+
+    // Delete the least recently used entries over the limits, call with the
+    // lock held
+    void prune();
+};
+
+#endif
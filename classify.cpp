@@ -0,0 +1,105 @@
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+#include "options.h"
+#include "classify.h"
+
+// Narrowest run of black we count as a box, a bit less than the width of the
+// smallest box we'd find
+static int minimumRun()
+{
+    return static_cast<int>(0.75*MIN_DIAG*ASPECT/std::sqrt(1 + ASPECT*ASPECT));
+}
+
+// Number of bands of rows in this range of columns with a run of black at
+// least minRun wide. Every other row is looked at, and bands taller than any
+// box are ignored since they're probably a picture or a border.
+static int countMarks(const Pixels& image, int startX, int endX, int minRun)
+{
+    int marks = 0;
+    int bandRows = 0;
+
+    for (int y = 0; y < image.height(); y += 2)
+    {
+        bool found = false;
+        int run = 0;
+
+        for (int x = startX; x < endX && !found; ++x)
+        {
+            run = image.black(Coord(x, y))?run+1:0;
+            found = run >= minRun;
+        }
+
+        if (found)
+        {
+            ++bandRows;
+        }
+        else
+        {
+            if (2*bandRows >= MIN_HEIGHT && 2*bandRows <= MAX_DIAG)
+                ++marks;
+
+            bandRows = 0;
+        }
+    }
+
+    return marks;
+}
+
+PageKind classifyPage(const Pixels& image, std::string& reason)
+{
+    const int w = image.width();
+    const int h = image.height();
+
+    // How much of the page is ink, from a sample of the pixels
+    long long samples = 0;
+    long long black = 0;
+
+    for (int y = 0; y < h; y += CLASSIFY_STEP)
+    {
+        for (int x = 0; x < w; x += CLASSIFY_STEP)
+        {
+            ++samples;
+
+            if (image.black(Coord(x, y)))
+                ++black;
+        }
+    }
+
+    const double ink = (samples > 0)?1.0*black/samples:0;
+
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(2) << 100*ink << "% ink";
+
+    if (ink < CLASSIFY_BLANK)
+    {
+        reason = "blank page (" + s.str() + ")";
+        return PageKind::Blank;
+    }
+
+    if (ink > CLASSIFY_DARK)
+    {
+        reason = "page is mostly black (" + s.str() + "), not a form";
+        return PageKind::Foreign;
+    }
+
+    // The boxes down the left side, or the right if it's upside down
+    const int strip = static_cast<int>(CLASSIFY_STRIP*w);
+    const int minRun = minimumRun();
+    int marks = countMarks(image, 0, strip, minRun);
+
+    if (marks < CLASSIFY_MARKS)
+        marks = std::max(marks, countMarks(image, w - strip, w, minRun));
+
+    if (marks < CLASSIFY_MARKS)
+    {
+        std::ostringstream r;
+        r << "no column of boxes along the edge (" << marks << " found), not a form";
+        reason = r.str();
+        return PageKind::Foreign;
+    }
+
+    return PageKind::Form;
+}
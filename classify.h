@@ -0,0 +1,30 @@
+/*
+ * Cheap check of whether a page could be one of our forms, done before the
+ * expensive labeling and box finding so that the blank backs of duplex scans,
+ * cover sheets, etc. are rejected in a few milliseconds
+ *
+ * A page with almost no ink is blank, and one that's mostly black is a photo
+ * or an inverted scan. Otherwise, it has to have the column of black boxes
+ * down the side. In a strip along the left edge (or the right if it's upside
+ * down), each band of rows containing a solid run of black about as wide as
+ * a box counts as a box, and there have to be enough of them.
+ */
+
+#ifndef H_CLASSIFY
+#define H_CLASSIFY
+
+#include <string>
+
+#include "pixels.h"
+
+enum class PageKind
+{
+    Form,
+    Blank,
+    Foreign
+};
+
+// What this page looks like. If it's not a form, reason says why.
+PageKind classifyPage(const Pixels& image, std::string& reason);
+
+#endif
@@ -1,7 +1,294 @@
 #include "cores.h"
 
-#if defined(linux) || defined(__linux) || defined(__linux__) || \
-    defined(sun) || defined(__sun) || \
+#if defined(linux) || defined(__linux) || defined(__linux__)
+#include <map>
+#include <set>
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <algorithm>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+
+// First line of a file, false if we can't read it
+static bool readLine(const std::string& filename, std::string& line)
+{
+    std::ifstream in(filename);
+    return in && std::getline(in, line);
+}
+
+// Lists like "0-3,8,10-11" used for CPUs and nodes
+static std::vector<int> parseList(const std::string& list)
+{
+    std::vector<int> result;
+    std::istringstream in(list);
+    std::string range;
+
+    while (std::getline(in, range, ','))
+    {
+        int first, last;
+        char dash;
+        std::istringstream r(range);
+
+        if (!(r >> first))
+            continue;
+
+        if (!(r >> dash >> last))
+            last = first;
+
+        for (int i = first; i <= last; ++i)
+            result.push_back(i);
+    }
+
+    return result;
+}
+
+// Our cgroup from /proc/self/cgroup, e.g. "/docker/abc", for a v1 controller
+// or the v2 hierarchy if controller is empty
+static std::string cgroupPath(const std::string& controller)
+{
+    std::ifstream in("/proc/self/cgroup");
+    std::string line;
+
+    while (std::getline(in, line))
+    {
+        // Each line is "id:controllers:path"
+        std::string::size_type first = line.find(':');
+        std::string::size_type second = line.find(':', first+1);
+
+        if (first == std::string::npos || second == std::string::npos)
+            continue;
+
+        std::string controllers = line.substr(first+1, second-first-1);
+
+        if (controller.empty())
+        {
+            if (controllers.empty() && line.substr(0, first) == "0")
+                return line.substr(second+1);
+        }
+        else
+        {
+            std::string list;
+            std::istringstream c(controllers);
+
+            while (std::getline(c, list, ','))
+                if (list == controller)
+                    return line.substr(second+1);
+        }
+    }
+
+    return "";
+}
+
+// The quota in CPUs set in this cgroup directory, 0 if unlimited
+static double cgroupQuota(const std::string& dir, bool v2)
+{
+    std::string line;
+
+    if (v2)
+    {
+        // "max 100000" or "400000 100000"
+        if (!readLine(dir + "/cpu.max", line))
+            return 0;
+
+        std::istringstream in(line);
+        std::string quota;
+        double period = 0;
+
+        if (!(in >> quota >> period) || quota == "max" || period <= 0)
+            return 0;
+
+        return std::stod(quota)/period;
+    }
+
+    std::string period;
+
+    if (!readLine(dir + "/cpu.cfs_quota_us", line) ||
+        !readLine(dir + "/cpu.cfs_period_us", period))
+        return 0;
+
+    const double q = std::stod(line);
+    const double p = std::stod(period);
+
+    // Quota is -1 if unlimited
+    return (q > 0 && p > 0)?q/p:0;
+}
+
+// The smallest quota of our cgroup and its parents. In a container, our
+// cgroup is usually the root of what's mounted, so also check that.
+static double findQuota()
+{
+    std::vector<std::pair<std::string, bool>> bases = {
+        { "/sys/fs/cgroup", true },
+        { "/sys/fs/cgroup/cpu", false },
+        { "/sys/fs/cgroup/cpu,cpuacct", false }
+    };
+
+    double quota = 0;
+
+    for (const std::pair<std::string, bool>& base : bases)
+    {
+        std::string path = cgroupPath(base.second?"":"cpu");
+
+        while (true)
+        {
+            const double q = cgroupQuota(base.first + path, base.second);
+
+            if (q > 0 && (quota == 0 || q < quota))
+                quota = q;
+
+            if (path.empty() || path == "/")
+                break;
+
+            std::string::size_type slash = path.rfind('/');
+            path = (slash == std::string::npos)?"":path.substr(0, slash);
+        }
+    }
+
+    return quota;
+}
+
+static CpuTopology findTopology()
+{
+    CpuTopology t;
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int i = 0; i < CPU_SETSIZE; ++i)
+            if (CPU_ISSET(i, &set))
+                t.cpus.push_back(i);
+    }
+    else
+    {
+        for (int i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); ++i)
+            t.cpus.push_back(i);
+    }
+
+    // Which NUMA node each CPU is on, if there's more than one
+    std::map<int, int> nodeOf;
+
+    if (DIR* dir = opendir("/sys/devices/system/node"))
+    {
+        while (dirent* entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            std::string list;
+
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+                name.find_first_not_of("0123456789", 4) != std::string::npos ||
+                !readLine("/sys/devices/system/node/" + name + "/cpulist", list))
+                continue;
+
+            for (int cpu : parseList(list))
+                nodeOf[cpu] = std::stoi(name.substr(4));
+        }
+
+        closedir(dir);
+    }
+
+    // Hyperthreads have the same core ID on the same socket
+    std::map<std::pair<int, int>, int> coreIds;
+
+    for (int cpu : t.cpus)
+    {
+        const std::string topology = "/sys/devices/system/cpu/cpu" +
+            std::to_string(cpu) + "/topology/";
+        std::string package, core;
+        std::pair<int, int> id(-1, cpu);
+
+        if (readLine(topology + "physical_package_id", package) &&
+            readLine(topology + "core_id", core))
+            id = std::make_pair(std::stoi(package), std::stoi(core));
+
+        std::map<std::pair<int, int>, int>::iterator i = coreIds.find(id);
+
+        if (i == coreIds.end())
+            i = coreIds.insert(std::make_pair(id, coreIds.size())).first;
+
+        t.cores.push_back(i->second);
+        t.nodes.push_back(nodeOf.count(cpu)?nodeOf[cpu]:0);
+    }
+
+    t.quota = findQuota();
+
+    return t;
+}
+
+const CpuTopology& cpu_topology()
+{
+    static const CpuTopology topology = findTopology();
+    return topology;
+}
+
+int core_count()
+{
+    static int count = 0;
+
+    if (count == 0)
+    {
+        const CpuTopology& t = cpu_topology();
+        count = std::set<int>(t.cores.begin(), t.cores.end()).size();
+
+        if (count == 0)
+            count = sysconf(_SC_NPROCESSORS_ONLN);
+
+        // More threads than the quota just get throttled
+        if (t.quota > 0)
+            count = std::min(count, std::max(1, static_cast<int>(std::ceil(t.quota))));
+    }
+
+    if (count <= 0)
+        return DEFAULT_CORES;
+
+    return count;
+}
+
+std::vector<int> worker_cpus(int threads)
+{
+    const CpuTopology& t = cpu_topology();
+
+    if (t.cpus.empty())
+        return std::vector<int>();
+
+    // Sort by which hyperthread of its core this is, then how many CPUs of
+    // that kind are before it on the same node, then the node
+    std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> order;
+    std::map<int, int> siblings;
+    std::map<std::pair<int, int>, int> onNode;
+
+    for (std::vector<int>::size_type i = 0; i < t.cpus.size(); ++i)
+    {
+        const int sibling = siblings[t.cores[i]]++;
+        const int position = onNode[std::make_pair(t.nodes[i], sibling)]++;
+
+        order.push_back(std::make_pair(std::make_pair(sibling, position),
+                    std::make_pair(t.nodes[i], t.cpus[i])));
+    }
+
+    std::sort(order.begin(), order.end());
+
+    std::vector<int> cpus;
+
+    for (int i = 0; i < threads; ++i)
+        cpus.push_back(order[i%order.size()].second.second);
+
+    return cpus;
+}
+
+bool pin_thread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    // Zero is the calling thread
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+#elif defined(sun) || defined(__sun) || \
     defined(__APPLE__)
 #include <unistd.h>
 int core_count()
@@ -42,3 +329,15 @@ int core_count()
 #else
 int core_count() { return DEFAULT_CORES; }
 #endif
+
+#if !(defined(linux) || defined(__linux) || defined(__linux__))
+// We only know the topology and how to pin threads on Linux
+const CpuTopology& cpu_topology()
+{
+    static const CpuTopology topology;
+    return topology;
+}
+
+std::vector<int> worker_cpus(int) { return std::vector<int>(); }
+bool pin_thread(int) { return false; }
+#endif
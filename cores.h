@@ -4,15 +4,51 @@
  * This is separated into a different headers since this is one of the
  * only parts of the program that is OS specific. It is messy, so I might
  * as well only have one really messy file.
+ *
+ * On Linux, this only counts the CPUs we're allowed to run on (e.g. with
+ * taskset), counts hyperthreads on the same core once, and limits it to the
+ * container's CPU quota if there is one. Elsewhere, it's just the number of
+ * processors.
  */
 
 #ifndef H_CORES
 #define H_CORES
 
+#include <vector>
+
 // Default to using two threads
 #define DEFAULT_CORES 2
 
-// Different for every OS...
+// The CPUs we can run on
+struct CpuTopology
+{
+    // Logical CPUs in our affinity mask and, for each, which physical core
+    // (numbered across all sockets) and NUMA node it is on
+    std::vector<int> cpus;
+    std::vector<int> cores;
+    std::vector<int> nodes;
+
+    // How many CPUs' worth of time the cgroup quota allows, 0 if unlimited
+    double quota;
+
+    CpuTopology()
+        : quota(0)
+    {
+    }
+};
+
+// Different for every OS... Cached after the first call.
+const CpuTopology& cpu_topology();
+
+// Number of threads to use: physical cores we can run on, limited by quota
 int core_count();
 
+// The CPU to pin each of this many workers to, one per physical core before
+// putting any on the other hyperthreads of a core, and taking turns between
+// NUMA nodes. Empty if we can't pin threads on this OS.
+std::vector<int> worker_cpus(int threads);
+
+// Pin the calling thread to a CPU, returning whether it worked
+bool pin_thread(int cpu);
+
 #endif
@@ -0,0 +1,526 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <stdexcept>
+#include <algorithm>
+
+#include "log.h"
+#include "options.h"
+#include "decoders.h"
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+// Sent to a child along with a memfd holding the image data
+struct DecodeRequest
+{
+    std::int32_t type;
+    std::int64_t size;
+};
+
+// Sent back along with a memfd holding the gray plane if it worked. Also sent
+// once when the child starts to say it's ready.
+struct DecodeReply
+{
+    std::int32_t ok;
+    std::int32_t width;
+    std::int32_t height;
+    char error[256];
+};
+
+// Send a message with a file descriptor, unless fd is -1
+static bool sendWithFd(int socket, const void* data, std::size_t len, int fd)
+{
+    iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = len;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd >= 0)
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+
+    // Don't get killed by SIGPIPE if the other end died
+    ssize_t sent;
+
+    do
+    {
+        sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    return sent == static_cast<ssize_t>(len);
+}
+
+// Wait up to timeout milliseconds, or forever if -1, for something to read
+// or for the other end to close. Returns false if it timed out.
+static bool readable(int socket, int timeout)
+{
+    const std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+    pollfd p;
+    p.fd = socket;
+    p.events = POLLIN;
+
+    while (true)
+    {
+        int left = timeout;
+
+        if (timeout >= 0)
+            left = std::max<long long>(0,
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    end - std::chrono::steady_clock::now()).count());
+
+        const int ready = poll(&p, 1, left);
+
+        if (ready < 0 && errno == EINTR)
+            continue;
+
+        return ready > 0;
+    }
+}
+
+// Receive a message, setting fd to the file descriptor sent with it or -1.
+// Returns false if the other end is gone, nothing came in timeout
+// milliseconds (-1 waits forever), or it's not the right size.
+static bool recvWithFd(int socket, void* data, std::size_t len, int& fd,
+    int timeout = -1)
+{
+    fd = -1;
+
+    if (!readable(socket, timeout))
+        return false;
+
+    iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = len;
+
+    char control[CMSG_SPACE(sizeof(int))];
+
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t got;
+
+    do
+    {
+        got = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+
+    if (got > 0)
+        for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+                std::memcpy(&fd, CMSG_DATA(c), sizeof(int));
+
+    if (got != static_cast<ssize_t>(len))
+    {
+        if (fd >= 0)
+            close(fd);
+
+        fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+// Whether this file has at least this many bytes, so mapping that many
+// won't SIGBUS when reading past the end
+static bool hasBytes(int fd, std::size_t bytes)
+{
+    struct stat info;
+
+    return fstat(fd, &info) == 0 && info.st_size >= 0 &&
+        static_cast<unsigned long long>(info.st_size) >= bytes;
+}
+
+// A memfd holding a copy of this data, -1 on error
+static int sharedMemory(const void* data, std::size_t size)
+{
+    int fd = memfd_create("freetron", MFD_CLOEXEC);
+
+    if (fd < 0)
+        return -1;
+
+    const char* p = static_cast<const char*>(data);
+
+    while (size > 0)
+    {
+        ssize_t written = write(fd, p, size);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        if (written <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+
+        p += written;
+        size -= written;
+    }
+
+    return fd;
+}
+
+DecoderPool::~DecoderPool()
+{
+    for (Child& child : children)
+        stop(child);
+}
+
+DecoderPool& DecoderPool::instance()
+{
+    static DecoderPool pool;
+    return pool;
+}
+
+void DecoderPool::start(int count)
+{
+    DecoderPool& pool = instance();
+    std::unique_lock<std::mutex> lck(pool.lock);
+
+    for (int i = 0; i < count; ++i)
+    {
+        Child child;
+
+        if (!pool.spawn(child))
+        {
+            log("couldn't start decoder processes, decoding in this one");
+            break;
+        }
+
+        pool.children.push_back(child);
+    }
+}
+
+bool DecoderPool::spawn(Child& child)
+{
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, fds) != 0)
+        return false;
+
+    // Only async-signal-safe calls are allowed between fork and exec since
+    // other threads may have held locks when we forked, so set up
+    // everything first
+    const std::string fd = std::to_string(fds[1]);
+    const char* argv[] = { "freetron", "--decoder", fd.c_str(), nullptr };
+    const long maxFd = sysconf(_SC_OPEN_MAX);
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        // Don't hold on to the website's sockets, the database, etc.
+        for (long i = 3; i < maxFd; ++i)
+            if (i != fds[1])
+                close(i);
+
+        fcntl(fds[1], F_SETFD, 0);
+        execv("/proc/self/exe", const_cast<char* const*>(argv));
+        _exit(127);
+    }
+
+    close(fds[1]);
+
+    if (pid < 0)
+    {
+        close(fds[0]);
+        return false;
+    }
+
+    child.pid = pid;
+    child.socket = fds[0];
+
+    // Wait till it says it's ready so we know it started
+    DecodeReply ready;
+    int none;
+
+    if (!recvWithFd(child.socket, &ready, sizeof(ready), none,
+            DECODER_TIMEOUT_MS) || !ready.ok)
+    {
+        stop(child);
+        return false;
+    }
+
+    return true;
+}
+
+void DecoderPool::stop(Child& child)
+{
+    if (child.socket >= 0)
+        close(child.socket);
+
+    if (child.pid > 0)
+    {
+        kill(child.pid, SIGKILL);
+        waitpid(child.pid, nullptr, 0);
+    }
+
+    child.pid = -1;
+    child.socket = -1;
+}
+
+Pixels DecoderPool::decode(ILenum type, const char* lump, int size,
+    const std::string& fn)
+{
+    DecoderPool& pool = instance();
+    Child* child = nullptr;
+
+    {
+        std::unique_lock<std::mutex> lck(pool.lock);
+
+        if (!pool.children.empty())
+        {
+            while (!child)
+            {
+                for (Child& c : pool.children)
+                {
+                    if (!c.busy)
+                    {
+                        child = &c;
+                        break;
+                    }
+                }
+
+                if (!child)
+                    pool.available.wait(lck);
+            }
+
+            child->busy = true;
+        }
+    }
+
+    if (!child)
+        return Pixels(type, lump, size, fn);
+
+    try
+    {
+        Pixels pixels = pool.decode(*child, type, lump, size, fn);
+
+        {
+            std::unique_lock<std::mutex> lck(pool.lock);
+            child->busy = false;
+        }
+
+        pool.available.notify_one();
+        return pixels;
+    }
+    catch (...)
+    {
+        {
+            std::unique_lock<std::mutex> lck(pool.lock);
+            child->busy = false;
+        }
+
+        pool.available.notify_one();
+        throw;
+    }
+}
+
+Pixels DecoderPool::decode(Child& child, ILenum type, const char* lump,
+    int size, const std::string& fn)
+{
+    // If we couldn't restart it last time, try again, otherwise do it here
+    if (child.socket < 0 && !spawn(child))
+        return Pixels(type, lump, size, fn);
+
+    int data = sharedMemory(lump, size);
+
+    if (data < 0)
+        throw std::runtime_error("couldn't create shared memory for decoding");
+
+    DecodeRequest request;
+    request.type = type;
+    request.size = size;
+
+    const bool sent = sendWithFd(child.socket, &request, sizeof(request), data);
+    close(data);
+
+    DecodeReply reply;
+    int plane = -1;
+
+    if (!sent || !recvWithFd(child.socket, &reply, sizeof(reply), plane,
+            DECODER_TIMEOUT_MS))
+    {
+        // It died or is stuck, probably on this image, so kill it and start
+        // a new one for the next
+        stop(child);
+
+        if (!spawn(child))
+            log("couldn't restart decoder process");
+
+        throw std::runtime_error("decoder process crashed or timed out, "
+            "could not read image");
+    }
+
+    if (!reply.ok)
+    {
+        if (plane >= 0)
+            close(plane);
+
+        reply.error[sizeof(reply.error)-1] = '\0';
+        throw std::runtime_error(reply.error);
+    }
+
+    const std::size_t bytes = static_cast<std::size_t>(reply.width)*reply.height;
+
+    if (plane < 0 || reply.width <= 0 || reply.height <= 0 ||
+        !hasBytes(plane, bytes))
+    {
+        if (plane >= 0)
+            close(plane);
+
+        throw std::runtime_error("decoder process returned an invalid image");
+    }
+
+    void* map = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, plane, 0);
+    close(plane);
+
+    if (map == MAP_FAILED)
+        throw std::runtime_error("couldn't map decoded image");
+
+    // Use it where it is rather than copying it again
+    MappedPlane mapped(static_cast<const unsigned char*>(map),
+        [bytes](const unsigned char* m) {
+            munmap(const_cast<unsigned char*>(m), bytes); });
+
+    return Pixels(reply.width, reply.height, std::move(mapped), fn);
+}
+
+int decoderMain(int socket)
+{
+    ilInit();
+
+    DecodeReply ready;
+    std::memset(&ready, 0, sizeof(ready));
+    ready.ok = 1;
+
+    if (!sendWithFd(socket, &ready, sizeof(ready), -1))
+        return 1;
+
+    DecodeRequest request;
+    int data;
+
+    // Till the parent closes the socket
+    while (recvWithFd(socket, &request, sizeof(request), data))
+    {
+        DecodeReply reply;
+        std::memset(&reply, 0, sizeof(reply));
+        int plane = -1;
+
+        try
+        {
+            if (data < 0 || request.size <= 0 || request.size > INT_MAX ||
+                !hasBytes(data, request.size))
+                throw std::runtime_error("invalid image data");
+
+            void* map = mmap(nullptr, request.size, PROT_READ, MAP_PRIVATE, data, 0);
+
+            if (map == MAP_FAILED)
+                throw std::runtime_error("couldn't map image data");
+
+            Pixels pixels;
+
+            try
+            {
+                pixels = Pixels(static_cast<ILenum>(request.type),
+                        static_cast<const char*>(map), request.size);
+            }
+            catch (...)
+            {
+                munmap(map, request.size);
+                throw;
+            }
+
+            munmap(map, request.size);
+
+            plane = sharedMemory(pixels.plane(),
+                static_cast<std::size_t>(pixels.width())*pixels.height());
+
+            if (plane < 0)
+                throw std::runtime_error("couldn't create shared memory for image");
+
+            reply.ok = 1;
+            reply.width = pixels.width();
+            reply.height = pixels.height();
+        }
+        catch (const std::exception& e)
+        {
+            std::strncpy(reply.error, e.what(), sizeof(reply.error)-1);
+        }
+
+        if (data >= 0)
+            close(data);
+
+        const bool sent = sendWithFd(socket, &reply, sizeof(reply), plane);
+
+        if (plane >= 0)
+            close(plane);
+
+        if (!sent)
+            break;
+    }
+
+    return 0;
+}
+#else
+// Without memfd and passing file descriptors, just decode in this process
+DecoderPool::~DecoderPool()
+{
+}
+
+DecoderPool& DecoderPool::instance()
+{
+    static DecoderPool pool;
+    return pool;
+}
+
+void DecoderPool::start(int count)
+{
+    if (count > 0)
+        log("decoder processes aren't supported on this OS, decoding in this one",
+            LogType::Warning);
+}
+
+Pixels DecoderPool::decode(ILenum type, const char* lump, int size,
+    const std::string& fn)
+{
+    return Pixels(type, lump, size, fn);
+}
+
+int decoderMain(int)
+{
+    return 1;
+}
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Decode images in child processes rather than in this one
+ *
+ * DevIL keeps global state, so Pixels only lets one thread decode at a time.
+ * Each child process has its own copy of DevIL, so with a few of them, that
+ * many pages can be decoded at once. The image data is sent to a child and
+ * the gray plane sent back in shared memory (memfd), so only the file
+ * descriptors go over the socket. The returned Pixels use the shared memory
+ * directly. If a malformed image crashes a child or it takes longer than
+ * DECODER_TIMEOUT_MS, that image fails to decode and the child is replaced.
+ *
+ * The children are this same program started with "--decoder fd", which
+ * main() hands to decoderMain() before doing anything else.
+ *
+ * Example:
+ *
+ *   DecoderPool::start(4);
+ *   Pixels p = DecoderPool::decode(IL_JPG, data, size, "form.pdf");
+ */
+
+#ifndef H_DECODERS
+#define H_DECODERS
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <condition_variable>
+#include <sys/types.h>
+#include <IL/il.h>
+
+#include "pixels.h"
+
+class DecoderPool
+{
+    struct Child
+    {
+        pid_t pid;
+        int socket;
+        bool busy;
+
+        Child()
+            : pid(-1), socket(-1), busy(false)
+        {
+        }
+    };
+
+    std::vector<Child> children;
+    std::mutex lock;
+    std::condition_variable available;
+
+    DecoderPool() { }
+
+public:
+    DecoderPool(const DecoderPool&) = delete;
+    DecoderPool& operator=(const DecoderPool&) = delete;
+    ~DecoderPool();
+
+    // Start this many children. Call once before decoding anything. If this
+    // OS can't start them, images are decoded in this process instead.
+    static void start(int count);
+
+    // Like Pixels(type, lump, size, fn) but in a child if we started any.
+    // Throws std::runtime_error if it couldn't be decoded or the child died
+    // or timed out.
+    static Pixels decode(ILenum type, const char* lump, int size,
+        const std::string& fn = "");
+
+private:
+    static DecoderPool& instance();
+
+    // Start or restart the child at this index, returning whether it worked
+    bool spawn(Child& child);
+
+    // Decode using this child, which we have to ourselves
+    Pixels decode(Child& child, ILenum type, const char* lump, int size,
+        const std::string& fn);
+
+    // Kill it if it's still running and wait for it to exit
+    void stop(Child& child);
+};
+
+// The main loop of a child, decoding the images sent over this socket till
+// it's closed. Returns the exit status.
+int decoderMain(int socket);
+
+#endif
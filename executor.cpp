@@ -0,0 +1,199 @@
+#include "executor.h"
+
+// So that queue() knows if we're being called from one of the workers, in
+// which case we can push onto that worker's own deque without locking
+static thread_local Executor* current_executor = nullptr;
+static thread_local int current_worker = -1;
+
+Executor::Executor(int threads, bool pin)
+    : queued(0), pending(0), waiting(false), killed(false)
+{
+    if (threads <= 0)
+        threads = core_count();
+
+    if (pin)
+        cpus = worker_cpus(threads);
+
+    for (std::atomic<long long>& c : injectedCount)
+        c = 0;
+
+    // Create all the deques before any of the threads start stealing
+    for (int i = 0; i < threads; ++i)
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+
+    for (int i = 0; i < threads; ++i)
+        pool.push_back(std::thread(&Executor::run, this, i));
+}
+
+Executor::~Executor()
+{
+    exit();
+
+    // Delete anything that didn't get run
+    for (std::unique_ptr<Worker>& w : workers)
+        for (WorkDeque<Task>& d : w->deques)
+            while (Task* t = d.steal())
+                delete t;
+
+    for (std::deque<Task*>& q : injected)
+        for (Task* t : q)
+            delete t;
+}
+
+void Executor::queue(Priority priority, std::function<void()> function)
+{
+    // Just to make sure we will actually process these eventually
+    if (waiting && current_executor != this)
+        throw ExecutorExited();
+
+    const int p = static_cast<int>(priority);
+    Task* task = new Task(std::move(function));
+
+    // Count it before it's visible so waiting workers don't exit early
+    ++pending;
+
+    if (current_executor == this)
+    {
+        workers[current_worker]->deques[p].push(task);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lck(injectedMutex);
+        injected[p].push_back(task);
+        ++injectedCount[p];
+    }
+
+    ++queued;
+    notify(false);
+}
+
+void Executor::notify(bool all)
+{
+    // Lock so a worker can't check the condition and then go to sleep after
+    // we've already notified
+    {
+        std::lock_guard<std::mutex> lck(sleepMutex);
+    }
+
+    if (all)
+        moreData.notify_all();
+    else
+        moreData.notify_one();
+}
+
+Task* Executor::take(int index, int priorities)
+{
+    const int count = workers.size();
+
+    for (int p = 0; p < priorities; ++p)
+    {
+        // Our own work first, most recent first since it's probably in cache
+        if (Task* t = workers[index]->deques[p].pop())
+            return t;
+
+        // Then things from outside the pool, oldest first
+        if (injectedCount[p] > 0)
+        {
+            std::lock_guard<std::mutex> lck(injectedMutex);
+
+            if (!injected[p].empty())
+            {
+                Task* t = injected[p].front();
+                injected[p].pop_front();
+                --injectedCount[p];
+                return t;
+            }
+        }
+
+        // Then steal from the others, starting at our neighbor so we don't
+        // all hammer the first worker
+        for (int i = 1; i < count; ++i)
+            if (Task* t = workers[(index+i)%count]->deques[p].steal())
+                return t;
+    }
+
+    return nullptr;
+}
+
+void Executor::run(int index)
+{
+    current_executor = this;
+    current_worker = index;
+
+    if (index < static_cast<int>(cpus.size()))
+        pin_thread(cpus[index]);
+
+    while (!killed)
+    {
+        Task* task = take(index);
+
+        if (task)
+        {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lck(sleepMutex);
+        moreData.wait(lck, [this]{
+            return queued > 0 || killed || (waiting && pending == 0); });
+
+        if ((waiting && pending == 0) || killed)
+            break;
+    }
+}
+
+void Executor::execute(Task* task)
+{
+    --queued;
+    task->function();
+    delete task;
+
+    // If this was the last thing, let everybody exit
+    if (--pending == 0 && waiting)
+        notify(true);
+}
+
+bool Executor::help(Priority priority)
+{
+    if (current_executor != this || killed)
+        return false;
+
+    Task* task = take(current_worker, static_cast<int>(priority)+1);
+
+    if (!task)
+        return false;
+
+    execute(task);
+    return true;
+}
+
+void Executor::exit()
+{
+    // You can only call this once
+    if (killed)
+        return;
+
+    killed = true;
+
+    // Cause all other non-working threads to die
+    notify(true);
+
+    // Wait for these to exit
+    for (std::thread& t : pool)
+        if (t.joinable())
+            t.join();
+}
+
+void Executor::wait()
+{
+    // We want all threads to die once there's nothing left to do
+    waiting = true;
+
+    // Cause all other non-working threads to die
+    notify(true);
+
+    // Wait for the results
+    for (std::thread& t : pool)
+        if (t.joinable())
+            t.join();
+}
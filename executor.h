@@ -0,0 +1,162 @@
+/*
+ * A single pool of worker threads shared by all the processing stages.
+ *
+ * Each worker has its own lock-free deque per priority. Tasks queued from a
+ * worker go on that worker's deque, tasks queued from other threads (e.g. the
+ * website) go on a shared injection queue. Idle workers steal from the others.
+ * Higher priority tasks are always taken first.
+ *
+ * Example:
+ *
+ *   void function(Input) { }
+ *   Executor e;
+ *   ExecutorStage<Input> stage(e, function, Priority::Normal);
+ *   stage.queue(Input);
+ *   // other processing
+ *   e.wait();
+ */
+
+#ifndef H_EXECUTOR
+#define H_EXECUTOR
+
+#include <deque>
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "cores.h"
+#include "workdeque.h"
+
+// Lower values are run first
+enum class Priority
+{
+    High = 0, Normal, Low
+};
+
+static const int PRIORITIES = 3;
+
+// Thrown if attempting to add more items from outside the pool after calling
+// wait(), since the threads will exit once there's nothing left to do.
+class ExecutorExited { };
+
+// What we put in the deques
+struct Task
+{
+    std::function<void()> function;
+
+    Task(std::function<void()>&& function)
+        : function(std::move(function))
+    {
+    }
+};
+
+class Executor
+{
+    // Each worker's deques, one for each priority
+    struct Worker
+    {
+        std::array<WorkDeque<Task>, PRIORITIES> deques;
+    };
+
+    // Our thread pool
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> pool;
+
+    // If pinning, the CPU for each worker
+    std::vector<int> cpus;
+
+    // Tasks queued from threads that aren't part of the pool
+    std::array<std::deque<Task*>, PRIORITIES> injected;
+    std::array<std::atomic<long long>, PRIORITIES> injectedCount;
+    std::mutex injectedMutex;
+
+    // Tasks in one of the queues and tasks queued or running. When waiting,
+    // we exit once there's nothing pending.
+    std::atomic<long long> queued;
+    std::atomic<long long> pending;
+
+    // Are we waiting for everything to finish? If so, exit once nothing is
+    // pending.
+    std::atomic_bool waiting;
+
+    // Did we already exit
+    std::atomic_bool killed;
+
+    // Signal we have more data (wake up a thread to process)
+    std::mutex sleepMutex;
+    std::condition_variable moreData;
+
+public:
+    // Create a pool with a certain number of threads. Defaults to the
+    // supposed number of cores if zero. If pin, each worker only runs on one
+    // CPU, spread across physical cores and NUMA nodes, so its buffers stay
+    // in that node's memory. Initialization does not block.
+    Executor(int threads = 0, bool pin = false);
+    ~Executor();
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // Add another task and wake up a thread to process it. Throws
+    // ExecutorExited() if called from outside the pool after wait().
+    void queue(Priority priority, std::function<void()> function);
+
+    // Block until all tasks, including any those tasks queue, have been
+    // processed. This will also exit all of the threads.
+    void wait();
+
+    // Quit processing new tasks
+    void exit();
+
+    // Number of worker threads
+    int threads() const { return pool.size(); }
+
+    // If called from one of the workers, run one queued task of at least this
+    // priority, returning whether there was one. Used so a task waiting on
+    // something can do useful work in the meantime rather than holding up a
+    // thread.
+    bool help(Priority priority);
+
+private:
+    // Thread main loop for the worker at this index
+    void run(int index);
+
+    // Get the next task for this worker looking at only the first few
+    // priorities, nullptr if there's nothing to do
+    Task* take(int index, int priorities = PRIORITIES);
+
+    // Run a task we took out of a queue
+    void execute(Task* task);
+
+    // Wake up sleeping workers
+    void notify(bool all);
+};
+
+// Typed wrapper so each stage of processing can queue items without knowing
+// about tasks or priorities
+template<class Item> class ExecutorStage
+{
+    Executor& executor;
+    void (*function)(Item);
+    Priority priority;
+
+public:
+    ExecutorStage(Executor& executor, void (*function)(Item),
+            Priority priority = Priority::Normal)
+        : executor(executor), function(function), priority(priority)
+    {
+    }
+
+    void queue(Item i)
+    {
+        void (*f)(Item) = function;
+        executor.queue(priority, [f, i]() { f(i); });
+    }
+};
+
+#endif
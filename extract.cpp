@@ -1,146 +1,1096 @@
+#include <deque>
+#include <mutex>
 #include <memory>
 #include <sstream>
 #include <fstream>
+#include <cstdio>
 #include <cstring>
+#include <exception>
+#include <condition_variable>
+#include <zlib.h>
 #include <IL/il.h>
 #include <tiffio.h>
-#include <tiffio.hxx>
 
+#include "cache.h"
+#include "sha256.h"
+#include "decoders.h"
+#include "pool.h"
+#include "math.h"
+#include "mappedfile.h"
 #include "extract.h"
 
-std::list<FormImage> extract(const std::string& filename, Form& form)
+// Follow a reference to the object it points to
+static PoDoFo::PdfObject* resolve(PoDoFo::PdfMemDocument& document,
+    PoDoFo::PdfObject* object)
 {
-    std::list<FormImage> images;
+    if (object && object->IsReference())
+        return document.GetObjects().GetObject(object->GetReference());
+
+    return object;
+}
+
+// A number in a dictionary, e.g. the width of an image, 0 if it's not there
+static long long number(PoDoFo::PdfMemDocument& document,
+    PoDoFo::PdfObject* object, const char* key)
+{
+    PoDoFo::PdfObject* value = resolve(document,
+            object->GetDictionary().GetKey(PoDoFo::PdfName(key)));
+
+    return (value && value->IsNumber())?value->GetNumber():0;
+}
+
+// A TIFF file in memory so libtiff can write one and read it back without
+// going through a stream and copying it out of that, or read one we don't own
+// such as a mapped file
+struct MemoryTiff
+{
+    std::vector<unsigned char> data;
+    const unsigned char* view;
+    std::size_t viewSize;
+    toff_t offset;
+
+    MemoryTiff()
+        : view(nullptr), viewSize(0), offset(0)
+    {
+    }
+
+    MemoryTiff(const unsigned char* view, std::size_t viewSize)
+        : view(view), viewSize(viewSize), offset(0)
+    {
+    }
+
+    const unsigned char* bytes() const { return view?view:data.data(); }
+    std::size_t size() const { return view?viewSize:data.size(); }
+};
+
+static tmsize_t tiffRead(thandle_t handle, void* buf, tmsize_t size)
+{
+    MemoryTiff* file = static_cast<MemoryTiff*>(handle);
+
+    if (size < 0 || file->offset >= file->size())
+        return 0;
+
+    const toff_t left = file->size() - file->offset;
+    const tmsize_t len = (static_cast<toff_t>(size) < left)?size:left;
+
+    std::memcpy(buf, file->bytes() + file->offset, len);
+    file->offset += len;
+
+    return len;
+}
+
+static tmsize_t tiffWrite(thandle_t handle, void* buf, tmsize_t size)
+{
+    MemoryTiff* file = static_cast<MemoryTiff*>(handle);
+
+    if (size < 0 || file->view)
+        return 0;
+
+    if (file->offset + size > file->data.size())
+        file->data.resize(file->offset + size);
+
+    std::memcpy(file->data.data() + file->offset, buf, size);
+    file->offset += size;
+
+    return size;
+}
+
+static toff_t tiffSeek(thandle_t handle, toff_t offset, int whence)
+{
+    MemoryTiff* file = static_cast<MemoryTiff*>(handle);
+
+    if (whence == SEEK_CUR)
+        offset += file->offset;
+    else if (whence == SEEK_END)
+        offset += file->size();
+
+    file->offset = offset;
+    return offset;
+}
+
+static int tiffClose(thandle_t)
+{
+    return 0;
+}
+
+static toff_t tiffSize(thandle_t handle)
+{
+    return static_cast<MemoryTiff*>(handle)->size();
+}
+
+// Reading, libtiff can use the memory directly
+static int tiffMap(thandle_t handle, void** base, toff_t* size)
+{
+    MemoryTiff* file = static_cast<MemoryTiff*>(handle);
+
+    *base = const_cast<unsigned char*>(file->bytes());
+    *size = file->size();
+
+    return 1;
+}
+
+static void tiffUnmap(thandle_t, void*, toff_t)
+{
+}
+
+static TIFF* tiffOpen(MemoryTiff& file, const char* mode)
+{
+    file.offset = 0;
+
+    return TIFFClientOpen("Input", mode, &file, tiffRead, tiffWrite, tiffSeek,
+            tiffClose, tiffSize, tiffMap, tiffUnmap);
+}
+
+// The image XObject in these page resources with more than this many pixels,
+// setting pixels to its size, or nullptr if there isn't one. Looks in form
+// XObjects too, up to a few levels deep since they can include each other.
+static PoDoFo::PdfObject* largestImage(PoDoFo::PdfMemDocument& document,
+    PoDoFo::PdfObject* resources, long long& pixels, int depth = 0)
+{
+    resources = resolve(document, resources);
+
+    if (!resources || !resources->IsDictionary() || depth > MAX_XOBJECT_DEPTH)
+        return nullptr;
+
+    PoDoFo::PdfObject* xobjects = resolve(document,
+            resources->GetDictionary().GetKey(PoDoFo::PdfName("XObject")));
+
+    if (!xobjects || !xobjects->IsDictionary())
+        return nullptr;
+
+    PoDoFo::PdfObject* largest = nullptr;
+    const PoDoFo::TKeyMap& keys = xobjects->GetDictionary().GetKeys();
+
+    for (PoDoFo::TCIKeyMap i = keys.begin(); i != keys.end(); ++i)
+    {
+        PoDoFo::PdfObject* xobject = resolve(document, i->second);
+
+        if (!xobject || !xobject->IsDictionary())
+            continue;
+
+        PoDoFo::PdfObject* subtype = xobject->GetDictionary().GetKey(
+                PoDoFo::PdfName::KeySubtype);
+
+        if (!subtype || !subtype->IsName())
+            continue;
+
+        if (subtype->GetName().GetName() == "Image")
+        {
+            const long long size = number(document, xobject, "Width")*
+                number(document, xobject, "Height");
+
+            if (size > pixels)
+            {
+                pixels = size;
+                largest = xobject;
+            }
+        }
+        else if (subtype->GetName().GetName() == "Form")
+        {
+            PoDoFo::PdfObject* image = largestImage(document,
+                    xobject->GetDictionary().GetKey(PoDoFo::PdfName("Resources")),
+                    pixels, depth+1);
+
+            if (image)
+                largest = image;
+        }
+    }
+
+    return largest;
+}
+
+namespace
+{
+    // An image read from the PDF waiting to be decoded and then passed on in
+    // the order of the pages
+    struct Slot
+    {
+        EncodedImage image;
+        Pixels pixels;
+        long long reserved;
+        bool done;
+        std::exception_ptr error;
+
+        Slot(EncodedImage&& image)
+            : image(std::move(image)), reserved(0), done(false)
+        {
+        }
+    };
+
+    // Shared by the thread reading the PDF and those decoding the images.
+    // Tasks may still start after extract() returns, but then there's nothing
+    // left for them to do, so they never touch the callbacks.
+    struct Pipeline : public std::enable_shared_from_this<Pipeline>
+    {
+        std::mutex lock;
+        std::condition_variable changed;
+
+        // Images not passed on yet. The first is number emitted, and next is
+        // the number of the next one to decode.
+        std::deque<Slot> slots;
+        long long emitted;
+        long long next;
+
+        // Number of images that have reserved memory. They reserve in order,
+        // since memory is only given back once an image is passed on, and
+        // that's in order too. Otherwise a later image could hold memory an
+        // earlier one is waiting for, and neither could ever be passed on.
+        // Only one reserves at a time, the one before next if this is less.
+        long long reserving;
+
+        // Decodes in progress and whether somebody is passing on images
+        int running;
+        bool emitting;
+
+        // Set when we stop early, e.g. an image couldn't be decoded, the form
+        // was canceled, or reading the file failed, along with the first
+        // error from decoding
+        bool stopped;
+        std::exception_ptr error;
+
+        // Images passed to the callback
+        long long images;
+
+        const std::string& filename;
+        Form& form;
+        const SizeCallback& sizeCallback;
+        const ReleaseCallback& releaseCallback;
+        const ImageCallback& callback;
+        const SpawnCallback& spawn;
+
+        Pipeline(const std::string& filename, Form& form,
+                const SizeCallback& sizeCallback,
+                const ReleaseCallback& releaseCallback,
+                const ImageCallback& callback, const SpawnCallback& spawn)
+            : emitted(0), next(0), reserving(0), running(0), emitting(false),
+              stopped(false),
+              images(0), filename(filename), form(form),
+              sizeCallback(sizeCallback), releaseCallback(releaseCallback),
+              callback(callback), spawn(spawn)
+        {
+        }
+
+        // Whether decodeNext() would start on an image: there's one nobody
+        // has started on and nobody is reserving memory. Call with the lock.
+        bool claimable() const
+        {
+            return !stopped && reserving == next &&
+                next < emitted + static_cast<long long>(slots.size());
+        }
+
+        // Decode the next image nobody else is decoding, returning false if
+        // there isn't one. Also returns false rather than waiting if another
+        // image is still reserving memory, since that one queues a task for
+        // the next when it's done.
+        bool decodeNext();
+
+        // Once reading the file is done or failed, decode what's left on
+        // this thread, wait for the decodes other threads started, and give
+        // back the memory for what wasn't passed on
+        void finish();
+
+        // Pass on all the images that are decoded and next in order. Only
+        // one thread does this at a time.
+        void emit();
+    };
+}
+
+bool Pipeline::decodeNext()
+{
+    Slot* slot;
+    bool more;
+
+    {
+        std::unique_lock<std::mutex> lck(lock);
+
+        if (!claimable())
+            return false;
+
+        // Deque references stay valid when adding to the end, and this one
+        // isn't removed till it's done
+        slot = &slots[next - emitted];
+        ++next;
+        ++running;
+    }
+
+    try
+    {
+        // May block till there's enough memory to decode this, though the
+        // Processor parses pages while waiting
+        slot->reserved = sizeCallback(slot->image.width, slot->image.height);
+    }
+    catch (...)
+    {
+        slot->error = std::current_exception();
+    }
+
+    {
+        std::unique_lock<std::mutex> lck(lock);
+        ++reserving;
+        more = claimable();
+    }
+
+    changed.notify_all();
+
+    // Tasks for images queued while we were reserving returned without
+    // them, so queue one for the next. We're still running, so extract()
+    // hasn't returned and spawn is still there.
+    if (more)
+    {
+        std::shared_ptr<Pipeline> self = shared_from_this();
+        spawn([self]() { self->decodeNext(); });
+    }
+
+    try
+    {
+        if (!slot->error)
+            slot->pixels = decodeImage(slot->image, filename, form);
+    }
+    catch (...)
+    {
+        slot->error = std::current_exception();
+    }
+
+    // We only need the decoded image now
+    slot->image.data = std::vector<unsigned char>();
+
+    {
+        std::unique_lock<std::mutex> lck(lock);
+        slot->done = true;
+    }
+
+    // Only count it as finished once it's passed on so extract() doesn't
+    // return while we're still using the callbacks
+    emit();
+
+    {
+        std::unique_lock<std::mutex> lck(lock);
+        --running;
+    }
+
+    changed.notify_all();
+
+    return true;
+}
+
+void Pipeline::finish()
+{
+    std::unique_lock<std::mutex> lck(lock);
+
+    while (true)
+    {
+        if (claimable())
+        {
+            lck.unlock();
+            decodeNext();
+            lck.lock();
+        }
+        else if (running == 0 && !emitting)
+        {
+            break;
+        }
+        else
+        {
+            changed.wait(lck);
+        }
+    }
+
+    // If we stopped early, give back the memory for what wasn't passed on
+    for (Slot& slot : slots)
+        releaseCallback(slot.reserved);
+
+    slots.clear();
+}
+
+void Pipeline::emit()
+{
+    std::unique_lock<std::mutex> lck(lock);
+
+    if (emitting)
+        return;
+
+    emitting = true;
+
+    while (!slots.empty() && slots.front().done)
+    {
+        Slot slot = std::move(slots.front());
+        slots.pop_front();
+        ++emitted;
+
+        // Stop at the first error like we would decoding one at a time, and
+        // don't pass on anything after it
+        if (slot.error && !stopped)
+        {
+            stopped = true;
+            error = slot.error;
+        }
+
+        const bool use = !stopped && slot.pixels.isLoaded();
+
+        if (use)
+            ++images;
+
+        lck.unlock();
+
+        if (use)
+            callback(slot.image.index, slot.image.hash, std::move(slot.pixels),
+                    slot.reserved);
+        else
+            releaseCallback(slot.reserved);
+
+        lck.lock();
+    }
+
+    emitting = false;
+}
+
+// Queue an image to be decoded. Don't read too far ahead of the images we've
+// passed on, and while waiting, decode one ourselves rather than just sitting
+// here. Returns false if we've stopped.
+static bool queueImage(const std::shared_ptr<Pipeline>& pipeline,
+    EncodedImage&& encoded, const SpawnCallback& spawn)
+{
+    Pipeline& p = *pipeline;
+
+    {
+        std::unique_lock<std::mutex> lck(p.lock);
+
+        while (!p.stopped && p.slots.size() >= EXTRACT_AHEAD)
+        {
+            if (p.claimable())
+            {
+                lck.unlock();
+                p.decodeNext();
+                lck.lock();
+            }
+            else
+            {
+                p.changed.wait(lck);
+            }
+        }
+
+        if (p.stopped)
+            return false;
+
+        p.slots.push_back(Slot(std::move(encoded)));
+    }
+
+    spawn([pipeline]() { pipeline->decodeNext(); });
+    return true;
+}
+
+// Hash of an image read from a TIFF, PNG, or JPEG along with how it's to be
+// decoded, like imageHash for those in PDFs
+static std::string encodedHash(const EncodedImage& image)
+{
+    std::ostringstream s;
+    s << image.type << " " << image.colorspace << " " << image.componentbits << " "
+      << image.width << " " << image.height << " ";
+
+    const std::string header = s.str();
+    Sha256 hash;
+    hash.update(header.c_str(), header.size());
+    hash.update(image.bytes(), image.size());
+
+    return hash.hex();
+}
+
+// Hash of the current directory of a TIFF that will be decoded by libtiff,
+// from its compressed strips or tiles where they are in the file rather than
+// decoding it
+static std::string tiffPageHash(TIFF* tif, const EncodedImage& image)
+{
+    uint16 compression = COMPRESSION_NONE;
+    uint16 photometric = PHOTOMETRIC_MINISWHITE;
+    uint16 samples = 1;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+    TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+
+    std::ostringstream s;
+    s << image.type << " " << image.componentbits << " " << samples << " "
+      << compression << " " << photometric << " "
+      << image.width << " " << image.height << " ";
+
+    const std::string header = s.str();
+    Sha256 hash;
+    hash.update(header.c_str(), header.size());
+
+    const bool tiled = TIFFIsTiled(tif);
+    const uint32 count = tiled?TIFFNumberOfTiles(tif):TIFFNumberOfStrips(tif);
+    toff_t* offsets = nullptr;
+    toff_t* lengths = nullptr;
+
+    // Without them, we can't tell pages apart
+    if (!TIFFGetField(tif, tiled?TIFFTAG_TILEOFFSETS:TIFFTAG_STRIPOFFSETS, &offsets) ||
+        !TIFFGetField(tif, tiled?TIFFTAG_TILEBYTECOUNTS:TIFFTAG_STRIPBYTECOUNTS, &lengths))
+        return "";
+
+    for (uint32 i = 0; i < count; ++i)
+        if (offsets[i] < image.size() && lengths[i] <= image.size() - offsets[i])
+            hash.update(image.bytes() + offsets[i], lengths[i]);
+
+    return hash.hex();
+}
+
+// Read the largest image on each page of a PDF, returning how many were
+// skipped
+static long long readPDF(MappedFile& file, Form& form,
+    const std::shared_ptr<Pipeline>& pipeline, const SpawnCallback& spawn,
+    const CachedCallback& cachedCallback)
+{
+    long long skipped = 0;
     ColorSpace colorspace;
     PoDoFo::pdf_int64 componentbits;
     PoDoFo::PdfObject* obj = nullptr;
     PoDoFo::PdfObject* color = nullptr;
     PoDoFo::PdfObject* component = nullptr;
-    PoDoFo::PdfMemDocument document(filename.c_str());
-    PoDoFo::TCIVecObjects it = document.GetObjects().begin();
 
-    while (it != document.GetObjects().end())
+    // Objects are only parsed when we look at them, so walking the pages
+    // skips the fonts, annotations, etc. that we don't care about. They're
+    // read from the map of the file, which outlives the document.
+    PoDoFo::PdfMemDocument document;
+    document.LoadFromDevice(PoDoFo::PdfRefCountedInputDevice(
+                new PoDoFo::PdfInputDevice(&file.stream())));
+    const int pageCount = document.GetPageCount();
+
+    // We take one image per page, though some pages may not have one
+    form.expected = pageCount;
+
+    // PoDoFo isn't thread safe, so we read the images from the PDF here one
+    // at a time and decompress them later
+    for (int index = 0; index < pageCount; ++index)
     {
-        if ((*it)->IsDictionary())
+        // Already parsed this one before we were restarted
+        if (form.isResumed(index))
         {
-            PoDoFo::PdfObject* objType = (*it)->GetDictionary().GetKey(PoDoFo::PdfName::KeyType);
-            PoDoFo::PdfObject* objSubType = (*it)->GetDictionary().GetKey(PoDoFo::PdfName::KeySubtype);
+            ++skipped;
+            continue;
+        }
+
+        // The scan is the largest image on the page, ignoring logos, etc.
+        PoDoFo::PdfPage* page = document.GetPage(index);
+        long long pixels = 0;
+        PoDoFo::PdfObject* image = nullptr;
+
+        if (page)
+            image = largestImage(document, page->GetResources(), pixels);
+
+        if (!image)
+            continue;
+
+        // Colorspace
+        color = image->GetDictionary().GetKey(PoDoFo::PdfName("ColorSpace"));
+        colorspace = ColorSpace::Unknown;
+
+        if (color && color->IsReference())
+            color = document.GetObjects().GetObject(color->GetReference());
+
+        // Follow ICCBased reference to the Alternate colorspace
+        if (color && color->IsArray() && color->GetArray().GetSize() == 2 &&
+                // First item is ICCBased
+                color->GetArray()[0].IsName() &&
+                color->GetArray()[0].GetName().GetName() == "ICCBased" &&
+                // Second item is reference to color space
+                color->GetArray()[1].IsReference())
+        {
+            color = document.GetObjects().GetObject(color->GetArray()[1].GetReference());
+
+            if (color)
+                color = color->GetDictionary().GetKey(PoDoFo::PdfName("Alternate"));
+        }
 
-            if ((objType    && objType->IsName()    && objType->GetName().GetName() == "XObject") ||
-                (objSubType && objSubType->IsName() && objSubType->GetName().GetName() == "Image" ))
+        // Check if either RGB or Grayscale (either the specified
+        // colorspace or the alternate if using an ICCBased colorspace)
+        if (color && color->IsName())
+        {
+            std::string col = color->GetName().GetName();
+
+            if (col == "DeviceRGB")
+                colorspace = ColorSpace::RGB;
+            else if (col == "DeviceGray")
+                colorspace = ColorSpace::Gray;
+        }
+
+        // Bits per component
+        component = image->GetDictionary().GetKey(PoDoFo::PdfName("BitsPerComponent"));
+        componentbits = 8;
+
+        if (component && component->IsNumber())
+            componentbits = component->GetNumber();
+
+        // Stream
+        obj = image->GetDictionary().GetKey(PoDoFo::PdfName::KeyFilter);
+
+        // JPEG and Flate are in another array
+        if (obj && obj->IsArray() && obj->GetArray().GetSize() == 1 &&
+            ((obj->GetArray()[0].IsName() && obj->GetArray()[0].GetName().GetName() == "DCTDecode") ||
+             (obj->GetArray()[0].IsName() && obj->GetArray()[0].GetName().GetName() == "FlateDecode")))
+            obj = &obj->GetArray()[0];
+
+        // PNM is the default
+        PixelType type = PixelType::PNM;
+
+        if (obj && obj->IsName())
+        {
+            std::string name = obj->GetName().GetName();
+
+            if (name == "DCTDecode")
+                type = PixelType::JPG;
+            else if (name == "CCITTFaxDecode")
+                type = PixelType::TIF;
+        }
+
+        // If we've seen this exact image before, we don't need to
+        // decode it
+        std::string hash;
+
+        if (cachedCallback)
+            hash = imageHash(image, type, colorspace, componentbits);
+
+        if (!hash.empty() && cachedCallback(index, hash))
+        {
+            document.FreeObjectMemory(image);
+            ++skipped;
+            continue;
+        }
+
+        EncodedImage encoded;
+        encoded.index = index;
+        encoded.hash = hash;
+
+        const bool read = readPDFImage(image, type, colorspace, componentbits,
+                form, encoded);
+
+        // We have our own copy of the data now
+        document.FreeObjectMemory(image);
+
+        if (!read)
+            continue;
+
+        if (!queueImage(pipeline, std::move(encoded), spawn))
+            break;
+    }
+
+    return skipped;
+}
+
+
+// Read each directory of a TIFF as a page, returning how many were skipped.
+// Bilevel G4 pages in one strip, what scanners usually save, are decoded on
+// any thread just like CCITT images in PDFs. Anything else libtiff decodes
+// here.
+static long long readTIFF(MappedFile& file, Form& form,
+    const std::shared_ptr<Pipeline>& pipeline, const SpawnCallback& spawn,
+    const CachedCallback& cachedCallback)
+{
+    long long skipped = 0;
+    MemoryTiff memory(reinterpret_cast<const unsigned char*>(file.data()), file.size());
+    TIFF* tif = tiffOpen(memory, "r");
+
+    if (!tif)
+        throw std::runtime_error("could not read TIFF");
+
+    std::unique_ptr<TIFF, void(*)(TIFF*)> closer(tif, TIFFClose);
+    form.expected = TIFFNumberOfDirectories(tif);
+
+    for (long long index = 0; index == 0 || TIFFReadDirectory(tif); ++index)
+    {
+        // Already parsed this one before we were restarted
+        if (form.isResumed(index))
+        {
+            ++skipped;
+            continue;
+        }
+
+        uint32 width = 0;
+        uint32 height = 0;
+        uint16 bits = 1;
+        uint16 samples = 1;
+        uint16 compression = COMPRESSION_NONE;
+        uint16 photometric = PHOTOMETRIC_MINISWHITE;
+        uint16 fillorder = FILLORDER_MSB2LSB;
+
+        TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+        TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+        TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+        TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+        TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+        TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+        TIFFGetFieldDefaulted(tif, TIFFTAG_FILLORDER, &fillorder);
+
+        EncodedImage encoded;
+        encoded.index = index;
+        encoded.colorspace = ColorSpace::Gray;
+        encoded.width = width;
+        encoded.height = height;
+        encoded.inflate = false;
+
+        if (width == 0 || height == 0)
+        {
+            // Nothing to read, so we'll warn below
+        }
+        else if (compression == COMPRESSION_CCITTFAX4 && bits == 1 &&
+            samples == 1 && photometric == PHOTOMETRIC_MINISWHITE &&
+            fillorder == FILLORDER_MSB2LSB && TIFFNumberOfStrips(tif) == 1)
+        {
+            encoded.type = PixelType::TIF;
+            encoded.componentbits = 1;
+
+            const tmsize_t size = TIFFRawStripSize(tif, 0);
+
+            if (size > 0)
             {
-                // Colorspace
-                color = (*it)->GetDictionary().GetKey(PoDoFo::PdfName("ColorSpace"));
-                colorspace = ColorSpace::Unknown;
-
-                if (color && color->IsReference())
-                    color = document.GetObjects().GetObject(color->GetReference());
-
-                // Follow ICCBased reference to the Alternate colorspace
-                if (color && color->IsArray() && color->GetArray().GetSize() == 2 &&
-                        // First item is ICCBased
-                        color->GetArray()[0].IsName() &&
-                        color->GetArray()[0].GetName().GetName() == "ICCBased" &&
-                        // Second item is reference to color space
-                        color->GetArray()[1].IsReference())
-                {
-                    color = document.GetObjects().GetObject(color->GetArray()[1].GetReference());
-
-                    if (color)
-                        color = color->GetDictionary().GetKey(PoDoFo::PdfName("Alternate"));
-                }
-
-                // Check if either RGB or Grayscale (either the specified
-                // colorspace or the alternate if using an ICCBased colorspace)
-                if (color && color->IsName())
-                {
-                    std::string col = color->GetName().GetName();
-
-                    if (col == "DeviceRGB")
-                        colorspace = ColorSpace::RGB;
-                    else if (col == "DeviceGray")
-                        colorspace = ColorSpace::Gray;
-                }
-
-                // Bits per component
-                component = (*it)->GetDictionary().GetKey(PoDoFo::PdfName("BitsPerComponent"));
-                componentbits = 8;
-
-                if (component && component->IsNumber())
-                    componentbits = component->GetNumber();
-
-                // Stream
-                obj = (*it)->GetDictionary().GetKey(PoDoFo::PdfName::KeyFilter);
-
-                // JPEG and Flate are in another array
-                if (obj && obj->IsArray() && obj->GetArray().GetSize() == 1 &&
-                    ((obj->GetArray()[0].IsName() && obj->GetArray()[0].GetName().GetName() == "DCTDecode") ||
-                     (obj->GetArray()[0].IsName() && obj->GetArray()[0].GetName().GetName() == "FlateDecode")))
-                    obj = &obj->GetArray()[0];
-
-                Pixels pixels;
-
-                if (obj && obj->IsName())
-                {
-                    std::string name = obj->GetName().GetName();
-
-                    if (name == "DCTDecode")
-                        pixels = readPDFImage(*it, PixelType::JPG, colorspace, componentbits, filename, form);
-                    else if (name == "CCITTFaxDecode")
-                        pixels = readPDFImage(*it, PixelType::TIF, colorspace, componentbits, filename, form);
-                    // PNM is the default
-                    //else if (name == "FlateDecode")
-                    //  pixels = readPDFImage(*it, PixelType::PNM, colorspace, componentbits, filename, form);
-                    else
-                        pixels = readPDFImage(*it, PixelType::PNM, colorspace, componentbits, filename, form);
-                }
-                else
-                {
-                    pixels = readPDFImage(*it, PixelType::PNM, colorspace, componentbits, filename, form);
-                }
-
-                document.FreeObjectMemory(*it);
-
-                if (pixels.isLoaded())
-                    images.push_back(FormImage(form, std::move(pixels)));
+                encoded.data.resize(size);
+
+                if (TIFFReadRawStrip(tif, 0, encoded.data.data(), size) < 0)
+                    encoded.data.clear();
             }
         }
+        else
+        {
+            // Anything else libtiff decodes once memory is reserved for it
+            encoded.type = PixelType::TIFPage;
+            encoded.componentbits = bits;
+            encoded.mapped = memory.bytes();
+            encoded.mappedSize = memory.size();
+        }
 
-        ++it;
+        if (encoded.size() == 0)
+        {
+            std::ostringstream ss;
+            ss << "could not read page " << index+1 << " of TIFF";
+            form.log(ss.str(), LogType::Warning);
+            continue;
+        }
+
+        // If we've seen this exact page before, we don't need to decode it
+        if (cachedCallback)
+        {
+            encoded.hash = (encoded.type == PixelType::TIFPage)?
+                tiffPageHash(tif, encoded):encodedHash(encoded);
+
+            if (cachedCallback(index, encoded.hash))
+            {
+                ++skipped;
+                continue;
+            }
+        }
+
+        if (!queueImage(pipeline, std::move(encoded), spawn))
+            break;
     }
 
-    return images;
+    return skipped;
 }
 
-Pixels readPDFImage(PoDoFo::PdfObject* object, const PixelType type,
-    const ColorSpace colorspace, const PoDoFo::pdf_int64 componentbits,
-    const std::string& filename, Form& form)
+// Width and height from the header of a PNG or the frame header of a JPEG,
+// so we can reserve memory before decoding it. False if we can't find them.
+static bool imageSize(const FileType type, const unsigned char* data,
+    const std::size_t size, unsigned int& width, unsigned int& height)
 {
-    Pixels pixels;
+    if (type == FileType::PNG)
+    {
+        // The signature and then the IHDR chunk's length, type, width, and
+        // height, all big endian
+        if (size < 24)
+            return false;
+
+        width  = (data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
+        height = (data[20] << 24) | (data[21] << 16) | (data[22] << 8) | data[23];
+
+        return width > 0 && height > 0;
+    }
+
+    // Walk the JPEG markers till the start of frame
+    std::size_t i = 2;
+
+    while (i + 4 <= size)
+    {
+        if (data[i] != 0xFF)
+            return false;
+
+        const unsigned char marker = data[i+1];
+
+        // Fill bytes
+        if (marker == 0xFF)
+        {
+            ++i;
+            continue;
+        }
+
+        // Markers without a length
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD9))
+        {
+            i += 2;
+            continue;
+        }
+
+        // SOF0 to SOF15 except DHT, JPG, and DAC: length, precision,
+        // height, and then width
+        if (marker >= 0xC0 && marker <= 0xCF &&
+            marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            if (i + 9 > size)
+                return false;
+
+            height = (data[i+5] << 8) | data[i+6];
+            width  = (data[i+7] << 8) | data[i+8];
+
+            return width > 0 && height > 0;
+        }
+
+        // The image data started without a frame header
+        if (marker == 0xDA)
+            return false;
+
+        i += 2 + ((data[i+2] << 8) | data[i+3]);
+    }
+
+    return false;
+}
+
+// A PNG or JPEG is one page, decoded like a JPEG in a PDF. Returns how many
+// were skipped.
+static long long readImage(MappedFile& file, const FileType type, Form& form,
+    const std::shared_ptr<Pipeline>& pipeline, const SpawnCallback& spawn,
+    const CachedCallback& cachedCallback)
+{
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(file.data());
+
+    form.expected = 1;
+
+    if (form.isResumed(0))
+        return 1;
+
+    EncodedImage encoded;
+    encoded.index = 0;
+    encoded.type = (type == FileType::PNG)?PixelType::PNG:PixelType::JPG;
+    encoded.colorspace = ColorSpace::Unknown;
+    encoded.componentbits = 8;
+    encoded.inflate = false;
+
+    if (!imageSize(type, data, file.size(), encoded.width, encoded.height))
+        throw std::runtime_error("could not read image size");
+
+    // Decoded straight from the map rather than copied
+    encoded.mapped = data;
+    encoded.mappedSize = file.size();
+
+    if (cachedCallback)
+    {
+        encoded.hash = encodedHash(encoded);
+
+        if (cachedCallback(0, encoded.hash))
+            return 1;
+    }
+
+    queueImage(pipeline, std::move(encoded), spawn);
+    return 0;
+}
+
+long long extract(const std::string& filename, Form& form,
+    const SizeCallback& sizeCallback, const ReleaseCallback& releaseCallback,
+    const ImageCallback& callback, const SpawnCallback& spawn,
+    const CachedCallback& cachedCallback)
+{
+    // The images are read from a map of the file on this thread. Decoding
+    // them is done on other threads as well as this one.
+    MappedFile file(filename);
+    std::shared_ptr<Pipeline> pipeline = std::make_shared<Pipeline>(
+            filename, form, sizeCallback, releaseCallback, callback, spawn);
+    Pipeline& p = *pipeline;
+    long long skipped;
+
+    const FileType type = fileType(file.data(), file.size());
+
+    // If reading fails, the decodes already started still use the map and
+    // the callbacks, so wait for them before throwing
+    try
+    {
+        if (type == FileType::TIFF)
+            skipped = readTIFF(file, form, pipeline, spawn, cachedCallback);
+        else if (type == FileType::PNG || type == FileType::JPG)
+            skipped = readImage(file, type, form, pipeline, spawn, cachedCallback);
+        else
+            skipped = readPDF(file, form, pipeline, spawn, cachedCallback);
+    }
+    catch (...)
+    {
+        {
+            std::unique_lock<std::mutex> lck(p.lock);
+            p.stopped = true;
+        }
+
+        p.finish();
+        throw;
+    }
+
+    p.finish();
+
+    // Tasks that haven't run yet still have the pipeline, so take the error
+    // out of it
+    std::unique_lock<std::mutex> lck(p.lock);
+    std::exception_ptr error = p.error;
+    p.error = nullptr;
+
+    if (error)
+        std::rethrow_exception(error);
 
+    return p.images + skipped;
+}
+
+bool readPDFImage(PoDoFo::PdfObject* object, const PixelType type,
+    const ColorSpace colorspace, const PoDoFo::pdf_int64 componentbits,
+    Form& form, EncodedImage& image)
+{
     if (!object->GetDictionary().HasKey(PoDoFo::PdfName("Width")) ||
         !object->GetDictionary().HasKey(PoDoFo::PdfName("Height")))
-        return pixels;
+        return false;
+
+    image.type = type;
+    image.colorspace = colorspace;
+    image.componentbits = componentbits;
+    image.width  = object->GetDictionary().GetKey(PoDoFo::PdfName("Width"))->GetNumber();
+    image.height = object->GetDictionary().GetKey(PoDoFo::PdfName("Height"))->GetNumber();
+    image.inflate = false;
+
+    // Warn if unknown colorspace
+    if (type == PixelType::PNM && colorspace == ColorSpace::Unknown)
+        form.log("unknown color space on PDF image", LogType::Warning);
+
+    if (type == PixelType::TIF && componentbits != 1)
+        form.log("BitsPerComponent is not 1 for CCITTFaxDecode image in PDF", LogType::Warning);
 
-    const unsigned int width  = object->GetDictionary().GetKey(PoDoFo::PdfName("Width"))->GetNumber();
-    const unsigned int height = object->GetDictionary().GetKey(PoDoFo::PdfName("Height"))->GetNumber();
+    PoDoFo::PdfMemStream* stream = dynamic_cast<PoDoFo::PdfMemStream*>(object->GetStream());
 
-    if (type == PixelType::JPG)
+    // Uncompressed or just Flate compressed raw pixels we can decompress on
+    // any thread. Anything else, let PoDoFo decode now.
+    PoDoFo::PdfObject* filter = object->GetDictionary().GetKey(PoDoFo::PdfName::KeyFilter);
+
+    if (filter && filter->IsArray() && filter->GetArray().GetSize() == 1)
+        filter = &filter->GetArray()[0];
+
+    const bool flate = filter && filter->IsName() &&
+        filter->GetName().GetName() == "FlateDecode" &&
+        !object->GetDictionary().HasKey(PoDoFo::PdfName("DecodeParms"));
+
+    if (stream && (type != PixelType::PNM || !filter || flate))
     {
-        PoDoFo::PdfMemStream* stream = dynamic_cast<PoDoFo::PdfMemStream*>(object->GetStream());
-        pixels = Pixels(IL_JPG, stream->Get(), stream->GetLength(), filename);
+        image.data.assign(stream->Get(), stream->Get() + stream->GetLength());
+        image.inflate = type == PixelType::PNM && flate;
     }
-    else if (type == PixelType::TIF)
+    else
+    {
+        char* filtered;
+        PoDoFo::pdf_long len;
+        object->GetStream()->GetFilteredCopy(&filtered, &len);
+        image.data.assign(filtered, filtered + len);
+        std::free(filtered);
+    }
+
+    return true;
+}
+
+// Gray plane from 1-bit rows padded to whole bytes, where a set bit is black
+// like PBM
+static std::vector<unsigned char> expandBits(const unsigned char* bits,
+    const unsigned int width, const unsigned int height)
+{
+    const std::size_t rowBytes = (width + 7)/8;
+    std::vector<unsigned char> plane = BufferPool<unsigned char>::local().get(
+            static_cast<std::size_t>(width)*height, 0);
+
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        const unsigned char* row = bits + y*rowBytes;
+        unsigned char* out = plane.data() + static_cast<std::size_t>(y)*width;
+
+        for (unsigned int x = 0; x < width; ++x)
+            out[x] = (row[x/8] & (0x80 >> (x%8)))?0:255;
+    }
+
+    return plane;
+}
+
+// Gray plane from 8-bit RGB, averaging like Pixels does for DevIL images
+static std::vector<unsigned char> averageRGB(const unsigned char* rgb,
+    const unsigned int width, const unsigned int height)
+{
+    const std::size_t size = static_cast<std::size_t>(width)*height;
+    std::vector<unsigned char> plane = BufferPool<unsigned char>::local().get(size, 0);
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const unsigned char* p = rgb + 3*i;
+        plane[i] = smartFloor((1.0*p[0] + p[1] + p[2])/3);
+    }
+
+    return plane;
+}
+
+Pixels decodeImage(EncodedImage& image, const std::string& filename, Form& form)
+{
+    Pixels pixels;
+    const unsigned int width = image.width;
+    const unsigned int height = image.height;
+
+    if (image.type == PixelType::JPG || image.type == PixelType::PNG)
+    {
+        pixels = DecoderPool::decode((image.type == PixelType::PNG)?IL_PNG:IL_JPG,
+                reinterpret_cast<const char*>(image.bytes()),
+                image.size(), filename);
+    }
+    else if (image.type == PixelType::TIFPage)
+    {
+        // Each decode opens the mapped file itself, so this is thread safe
+        MemoryTiff file(image.bytes(), image.size());
+        TIFF* tif = tiffOpen(file, "r");
+        std::vector<uint32> rgba;
+        bool read = false;
+
+        if (tif && TIFFSetDirectory(tif, image.index))
+        {
+            rgba.resize(static_cast<std::size_t>(width)*height);
+            read = TIFFReadRGBAImageOriented(tif, width, height, rgba.data(),
+                    ORIENTATION_TOPLEFT, 0);
+        }
+
+        if (tif)
+            TIFFClose(tif);
+
+        if (!read)
+        {
+            std::ostringstream ss;
+            ss << "could not read page " << image.index+1 << " of TIFF";
+            form.log(ss.str(), LogType::Warning);
+            return pixels;
+        }
+
+        BufferPool<unsigned char>& pool = BufferPool<unsigned char>::local();
+        std::vector<unsigned char> plane = pool.get(rgba.size(), 0);
+
+        for (std::size_t i = 0; i < rgba.size(); ++i)
+            plane[i] = smartFloor((1.0*TIFFGetR(rgba[i]) +
+                        TIFFGetG(rgba[i]) + TIFFGetB(rgba[i]))/3);
+
+        pixels = Pixels(width, height, std::move(plane), filename);
+    }
+    else if (image.type == PixelType::TIF)
     {
         // Monochrome, otherwise wouldn't have used CCITT
         const unsigned int bits = 1;
         const unsigned int samples = 1;
 
-        if (bits != componentbits)
-            form.log("BitsPerComponent is not 1 for CCITTFaxDecode image in PDF", LogType::Warning);
+        // Wrap the CCITT data in a TIFF in memory so libtiff will decode it
+        MemoryTiff file;
+        file.data.reserve(image.data.size() + 1024);
+
+        TIFF* tif = tiffOpen(file, "w");
+
+        if (!tif)
+            throw std::runtime_error("could not create TIFF for PDF image");
 
-        std::ostringstream os;
-        TIFF* tif = TIFFStreamOpen("Input", &os);
         TIFFSetField(tif, TIFFTAG_IMAGEWIDTH,       width);
         TIFFSetField(tif, TIFFTAG_IMAGELENGTH,      height);
         TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE,    bits);
@@ -156,76 +1106,146 @@ Pixels readPDFImage(PoDoFo::PdfObject* object, const PixelType type,
         TIFFSetField(tif, TIFFTAG_FAXMODE,      FAXMODE_CLASSF);
         TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP,     (uint32)-1L);
 
-        // stream->Get returns read-only, so copy it
-        PoDoFo::PdfMemStream* stream = dynamic_cast<PoDoFo::PdfMemStream*>(object->GetStream());
-        const char* readonly = stream->Get();
-        PoDoFo::pdf_long len = stream->GetLength();
-        char* buffer = new char[len];
-        std::memcpy(buffer, readonly, len);
-
-        TIFFWriteRawStrip(tif, 0, buffer, len);
+        TIFFWriteRawStrip(tif, 0, image.data.data(), image.data.size());
         TIFFWriteDirectory(tif);
         TIFFClose(tif);
 
-        delete[] buffer;
+        // We're done with the encoded data
+        std::vector<unsigned char>().swap(image.data);
 
-        pixels = Pixels(IL_TIF, os.str().c_str(), os.tellp(), filename);
-    }
-    else
-    {
-        std::ostringstream os;
+        // Then decode the one strip, which is the whole image, in this thread.
+        // With MINISWHITE the decoded bits are 1 for black.
+        tif = tiffOpen(file, "r");
 
-        // P4 is bitmap (1 bit), P5 is graymap (8 bit), P6 is pixmap (24 bit or
-        // 8-bit/channel). See:
-        // http://netpbm.sourceforge.net/doc/pbm.html
-        // http://en.wikipedia.org/wiki/Portable_anymap#File_format_description
-        if (colorspace == ColorSpace::Gray)
-            os << ((componentbits == 1)?"P4\n":"P5\n");
-        else
-            os << "P6\n";
+        if (!tif)
+            throw std::runtime_error("could not read TIFF for PDF image");
 
-        os << width  << " "
-           << height << "\n";
+        BufferPool<unsigned char>& pool = BufferPool<unsigned char>::local();
+        const tmsize_t stripSize = TIFFStripSize(tif);
+        std::vector<unsigned char> strip = pool.get((stripSize > 0)?stripSize:0, 0);
 
-        if (componentbits != 1)
-           os << "255\n";
+        const tmsize_t decoded = (stripSize > 0)?
+            TIFFReadEncodedStrip(tif, 0, strip.data(), stripSize):-1;
+        TIFFClose(tif);
 
-        std::string s = os.str();
+        // A truncated stream decodes fewer bytes than the header says the
+        // strip has, so check what we actually got
+        if (decoded < 0 || static_cast<long long>(decoded) !=
+                correctLength(width, height, ColorSpace::Gray, 1))
+        {
+            pool.put(std::move(strip));
+            throw std::runtime_error("could not decode CCITT image in PDF");
+        }
 
-        char* buffer;
-        PoDoFo::pdf_long len;
+        pixels = Pixels(width, height, expandBits(strip.data(), width, height), filename);
+        pool.put(std::move(strip));
+    }
+    else
+    {
+        // Raw pixels, so no need for DevIL. Convert straight to the gray
+        // plane, or if it's already 8-bit gray, use the data as the plane.
+        BufferPool<unsigned char>& pool = BufferPool<unsigned char>::local();
+        const long long expected = correctLength(width, height,
+                image.colorspace, image.componentbits);
+        std::vector<unsigned char> raw;
 
-        object->GetStream()->GetFilteredCopy(&buffer, &len);
+        if (image.inflate)
+        {
+            // One more byte so we can tell if there was more data than expected
+            uLongf inflated = (expected > 0)?expected+1:0;
+            raw = pool.get(inflated, 0);
+
+            const int result = uncompress(raw.data(), &inflated,
+                    image.data.data(), image.data.size());
+
+            if (result != Z_OK && result != Z_BUF_ERROR)
+            {
+                pool.put(std::move(raw));
+                throw std::runtime_error("could not decompress PDF image");
+            }
 
-        // Warn if unknown colorspace
-        if (colorspace == ColorSpace::Unknown)
-            form.log("unknown color space on PDF image", LogType::Warning);
+            raw.resize(inflated);
+            std::vector<unsigned char>().swap(image.data);
+        }
+        else
+        {
+            raw = std::move(image.data);
+        }
 
         // If the buffer isn't the correct size for the image data, don't try
         // reading the image from this invalid data
-        if (len != correctLength(width, height, colorspace, componentbits))
+        if (static_cast<long long>(raw.size()) != expected)
         {
             std::ostringstream ss;
             ss << "wrong buffer size for PDF image of size "
                << width << "x" << height
-               << " (" << colorspace << "): " << len;
+               << " (" << image.colorspace << "): " << raw.size();
             form.log(ss.str(), LogType::Warning);
 
-            std::free(buffer);
+            pool.put(std::move(raw));
             return pixels;
         }
 
-        std::unique_ptr<char> stream(new char[len+s.size()]);
-        std::memcpy(stream.get(), s.c_str(), s.size());
-        std::memcpy(stream.get()+s.size(), buffer, len);
-        std::free(buffer);
-
-        pixels = Pixels(IL_PNM, stream.get(), len+s.size(), filename);
+        if (image.colorspace == ColorSpace::Gray && image.componentbits == 1)
+        {
+            pixels = Pixels(width, height, expandBits(raw.data(), width, height), filename);
+            pool.put(std::move(raw));
+        }
+        else if (image.colorspace == ColorSpace::Gray)
+        {
+            pixels = Pixels(width, height, std::move(raw), filename);
+        }
+        else
+        {
+            pixels = Pixels(width, height, averageRGB(raw.data(), width, height), filename);
+            pool.put(std::move(raw));
+        }
     }
 
     return pixels;
 }
 
+FileType fileType(const char* data, const std::size_t size)
+{
+    const unsigned char* d = reinterpret_cast<const unsigned char*>(data);
+
+    if (size >= 4 && ((d[0] == 'I' && d[1] == 'I' && d[2] == 42 && d[3] == 0) ||
+                      (d[0] == 'M' && d[1] == 'M' && d[2] == 0 && d[3] == 42)))
+        return FileType::TIFF;
+
+    if (size >= 8 && std::memcmp(d, "\x89PNG\r\n\x1a\n", 8) == 0)
+        return FileType::PNG;
+
+    if (size >= 3 && d[0] == 0xFF && d[1] == 0xD8 && d[2] == 0xFF)
+        return FileType::JPG;
+
+    return FileType::PDF;
+}
+
+std::string imageHash(PoDoFo::PdfObject* object, const PixelType type,
+    const ColorSpace colorspace, const PoDoFo::pdf_int64 componentbits)
+{
+    PoDoFo::PdfMemStream* stream = dynamic_cast<PoDoFo::PdfMemStream*>(object->GetStream());
+
+    if (!stream ||
+        !object->GetDictionary().HasKey(PoDoFo::PdfName("Width")) ||
+        !object->GetDictionary().HasKey(PoDoFo::PdfName("Height")))
+        return "";
+
+    // The same data could decode differently with a different size or format
+    std::ostringstream s;
+    s << type << " " << colorspace << " " << componentbits << " "
+      << object->GetDictionary().GetKey(PoDoFo::PdfName("Width"))->GetNumber() << " "
+      << object->GetDictionary().GetKey(PoDoFo::PdfName("Height"))->GetNumber() << " ";
+
+    const std::string header = s.str();
+    Sha256 hash;
+    hash.update(header.c_str(), header.size());
+    hash.update(stream->Get(), stream->GetLength());
+
+    return hash.hex();
+}
+
 // Determine the correct length of the image data buffer depending on the color
 // space, bit depth, etc.
 long long correctLength(const int width, const int height,
@@ -269,6 +1289,8 @@ std::ostream& operator<<(std::ostream& os, const PixelType& t)
         case PixelType::PNM: return os << "PNM";
         case PixelType::JPG: return os << "JPG";
         case PixelType::TIF: return os << "TIF";
+        case PixelType::PNG: return os << "PNG";
+        case PixelType::TIFPage: return os << "TIFPage";
         default: return os << "Unknown?";
     }
 }
@@ -1,6 +1,7 @@
 /*
  * Extract the images from the PDF using PoDoFo and libtiff, somewhat similar
- * to podofoimgextract and fax2tiff, a command-line utility
+ * to podofoimgextract and fax2tiff, a command-line utility. Scans saved as a
+ * multi-page TIFF, a PNG, or a JPEG are read directly instead.
  *
  * Useful stuff for tiffio:
  *   http://www.asmail.be/msg0055289992.html
@@ -15,8 +16,9 @@
 #ifndef H_EXTRACT
 #define H_EXTRACT
 
-#include <list>
 #include <string>
+#include <vector>
+#include <functional>
 #include <iostream>
 #include <podofo/podofo.h>
 
@@ -29,6 +31,17 @@ enum class PixelType
     PNM,    // Default
     JPG,    // DCTDecode
     TIF,    // CCITTFaxDecode
+    PNG,    // Only from PNG files
+    TIFPage // A page of a TIFF file other than a single strip of G4
+};
+
+// What kind of file a scan is, from the first few bytes
+enum class FileType
+{
+    PDF,    // Default
+    TIFF,
+    PNG,
+    JPG
 };
 
 enum class ColorSpace
@@ -38,10 +51,84 @@ enum class ColorSpace
     RGB     // PNM6
 };
 
-std::list<FormImage> extract(const std::string& filename, Form& form);
-Pixels readPDFImage(PoDoFo::PdfObject* object, const PixelType type,
+// An image read from the PDF but not decoded yet. It doesn't refer to the
+// document, so it can be decoded on any thread.
+struct EncodedImage
+{
+    long long index;
+    std::string hash;
+    PixelType type;
+    ColorSpace colorspace;
+    PoDoFo::pdf_int64 componentbits;
+    unsigned int width;
+    unsigned int height;
+
+    // Whether the data is still Flate compressed
+    bool inflate;
+    std::vector<unsigned char> data;
+
+    // Or for a PNG, JPEG, or TIFF file decoded as is, the whole file where
+    // it's mapped, which stays mapped till extract() returns. For a TIFF, the
+    // index is which directory it is.
+    const unsigned char* mapped = nullptr;
+    std::size_t mappedSize = 0;
+
+    inline const unsigned char* bytes() const { return mapped?mapped:data.data(); }
+    inline std::size_t size() const { return mapped?mappedSize:data.size(); }
+};
+
+// Called with each image as soon as it is decoded so that we can start
+// parsing it while we decode the rest, along with which image in the PDF
+// this is, the hash of its data if checked with the CachedCallback, and what
+// the SizeCallback reserved for it. Called in the order of the pages, though
+// not always from the same thread.
+typedef std::function<void(long long index, const std::string& hash,
+        Pixels&&, long long reserved)> ImageCallback;
+
+// Called with the dimensions of each image before decoding it so the caller
+// can wait till there's enough memory to decode it. Returns how much was
+// reserved, which is given back with the image or to the ReleaseCallback.
+typedef std::function<long long(long long width, long long height)> SizeCallback;
+
+// Called with what was reserved for an image that wasn't passed on, e.g. if
+// it couldn't be decoded
+typedef std::function<void(long long reserved)> ReleaseCallback;
+
+// Run this, probably on another thread
+typedef std::function<void(std::function<void()>)> SpawnCallback;
+
+// Called with the hash of each image's data before decoding it. If it returns
+// true, the caller already has the results for this image, so it's skipped.
+typedef std::function<bool(long long index, const std::string& hash)> CachedCallback;
+
+// Returns the number of images passed to the callback plus the number skipped
+// since the form says they were already done before a restart or because they
+// were cached. The images are read from the file on this thread, but decoded
+// in tasks given to spawn as well as on this thread. It doesn't return or
+// throw till they're all done. If one fails, the error is thrown once the ones
+// before it have been passed on.
+long long extract(const std::string& filename, Form& form,
+    const SizeCallback& sizeCallback, const ReleaseCallback& releaseCallback,
+    const ImageCallback& callback, const SpawnCallback& spawn,
+    const CachedCallback& cachedCallback = nullptr);
+
+// Get an image's data and how to decode it, false if it's missing its size.
+// Only compressed data we can't decompress on any thread is decompressed now.
+bool readPDFImage(PoDoFo::PdfObject* object, const PixelType type,
     const ColorSpace colorspace, const PoDoFo::pdf_int64 componentbits,
-    const std::string& filename, Form& form);
+    Form& form, EncodedImage& image);
+
+// Decode an image from readPDFImage or a TIFF, PNG, or JPEG file. This can be
+// done on any thread.
+Pixels decodeImage(EncodedImage& image, const std::string& filename, Form& form);
+
+// Whether this is a TIFF, PNG, JPEG, or otherwise hopefully a PDF
+FileType fileType(const char* data, const std::size_t size);
+
+// Hash of the raw data of an image along with how it's to be decoded, empty if
+// we can't get at the data
+std::string imageHash(PoDoFo::PdfObject* object, const PixelType type,
+    const ColorSpace colorspace, const PoDoFo::pdf_int64 componentbits);
 long long correctLength(const int width, const int height,
         const ColorSpace colorspace,
         const PoDoFo::pdf_int64 componentbits);
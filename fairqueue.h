@@ -0,0 +1,127 @@
+/*
+ * Queue that takes turns between flows (e.g. forms) rather than first in,
+ * first out, so a large form doesn't hold up everybody else's small ones
+ *
+ * This is deficit round robin with each item costing one: each time a flow
+ * comes up in the rotation, it gets its weight in credit and can take that
+ * many items before moving to the back. Urgent items skip ahead of all the
+ * flows, e.g. the first page of each form so it starts showing progress.
+ *
+ * Example:
+ *
+ *   FairQueue<Page*> q;
+ *   q.push(formA, &a1, 1);
+ *   q.push(formA, &a2, 1);
+ *   q.push(formB, &b1, 4);
+ *   q.pop(); // a1, then b1, then a2
+ */
+
+#ifndef H_FAIRQUEUE
+#define H_FAIRQUEUE
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+template<class Item> class FairQueue
+{
+    struct Flow
+    {
+        std::deque<Item> items;
+        int weight;
+        int deficit;
+
+        Flow()
+            : weight(1), deficit(0)
+        {
+        }
+    };
+
+    std::mutex lock;
+    std::deque<Item> urgent;
+    std::unordered_map<long long, Flow> flows;
+
+    // Flows with items in the order they'll get a turn
+    std::deque<long long> active;
+
+public:
+    FairQueue() { }
+
+    FairQueue(const FairQueue&) = delete;
+    FairQueue& operator=(const FairQueue&) = delete;
+
+    // Add an item to a flow. The weight (at least one) is how many items the
+    // flow gets per turn and replaces the flow's previous weight.
+    void push(long long flow, Item item, int weight = 1, bool isUrgent = false);
+
+    // Get the next item, returning false if there are none
+    bool pop(Item& item);
+};
+
+template<class Item> void FairQueue<Item>::push(long long flow, Item item,
+        int weight, bool isUrgent)
+{
+    std::unique_lock<std::mutex> lck(lock);
+
+    if (isUrgent)
+    {
+        urgent.push_back(item);
+        return;
+    }
+
+    Flow& f = flows[flow];
+
+    // It's new or it ran out, so it needs a turn
+    if (f.items.empty())
+        active.push_back(flow);
+
+    f.items.push_back(item);
+    f.weight = (weight > 0)?weight:1;
+}
+
+template<class Item> bool FairQueue<Item>::pop(Item& item)
+{
+    std::unique_lock<std::mutex> lck(lock);
+
+    if (!urgent.empty())
+    {
+        item = urgent.front();
+        urgent.pop_front();
+        return true;
+    }
+
+    while (!active.empty())
+    {
+        const long long id = active.front();
+        Flow& f = flows[id];
+
+        // Used up its turn, so give it credit for next time and move on
+        if (f.deficit <= 0)
+        {
+            f.deficit += f.weight;
+            active.pop_front();
+            active.push_back(id);
+
+            // Unless it's the only one
+            if (active.size() > 1)
+                continue;
+        }
+
+        item = f.items.front();
+        f.items.pop_front();
+        --f.deficit;
+
+        // Nothing left, so it doesn't keep any credit
+        if (f.items.empty())
+        {
+            active.pop_front();
+            flows.erase(id);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+#endif
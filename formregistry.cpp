@@ -0,0 +1,81 @@
+#include <stdexcept>
+
+#include "formregistry.h"
+
+FormRegistry::Shard& FormRegistry::shard(long long id)
+{
+    // IDs are sequential in the database, so this spreads them evenly
+    return shards[static_cast<unsigned long long>(id)%shards.size()];
+}
+
+Form* FormRegistry::add(std::unique_ptr<Form> form)
+{
+    Shard& s = shard(form->id);
+    std::unique_lock<std::mutex> lock(s.lock);
+
+    std::unique_ptr<Form>& slot = s.forms[form->id];
+
+    if (slot)
+        throw std::runtime_error("form " + std::to_string(form->id) +
+                " is already being processed");
+
+    slot = std::move(form);
+    return slot.get();
+}
+
+Form* FormRegistry::find(long long id)
+{
+    Shard& s = shard(id);
+    std::unique_lock<std::mutex> lock(s.lock);
+
+    std::unordered_map<long long, std::unique_ptr<Form>>::iterator i =
+        s.forms.find(id);
+
+    if (i == s.forms.end())
+        return nullptr;
+
+    return i->second.get();
+}
+
+bool FormRegistry::visit(long long id, const std::function<void(Form&)>& function)
+{
+    Shard& s = shard(id);
+    std::unique_lock<std::mutex> lock(s.lock);
+
+    std::unordered_map<long long, std::unique_ptr<Form>>::iterator i =
+        s.forms.find(id);
+
+    if (i == s.forms.end())
+        return false;
+
+    function(*i->second);
+    return true;
+}
+
+void FormRegistry::visitAll(const std::function<void(Form&)>& function)
+{
+    for (Shard& s : shards)
+    {
+        std::unique_lock<std::mutex> lock(s.lock);
+
+        for (std::pair<const long long, std::unique_ptr<Form>>& f : s.forms)
+            function(*f.second);
+    }
+}
+
+std::unique_ptr<Form> FormRegistry::remove(long long id)
+{
+    Shard& s = shard(id);
+    std::unique_lock<std::mutex> lock(s.lock);
+
+    std::unordered_map<long long, std::unique_ptr<Form>>::iterator i =
+        s.forms.find(id);
+
+    if (i == s.forms.end())
+        return nullptr;
+
+    std::unique_ptr<Form> form = std::move(i->second);
+    s.forms.erase(i);
+
+    return form;
+}
@@ -0,0 +1,68 @@
+/*
+ * The forms currently being processed, indexed by ID
+ *
+ * Split into shards each with their own lock so that looking up one form
+ * (e.g. on every status poll from the website) doesn't wait on other forms
+ * being added or finished. Forms are heap allocated, so their addresses stay
+ * the same while they're in here, which we need since pointers to them are
+ * queued for processing.
+ *
+ * Example:
+ *
+ *   FormRegistry forms;
+ *   Form* f = forms.add(std::unique_ptr<Form>(new Form(...)));
+ *   Form* g = forms.find(id); // nullptr if not found
+ *   std::unique_ptr<Form> h = forms.remove(id);
+ */
+
+#ifndef H_FORMREGISTRY
+#define H_FORMREGISTRY
+
+#include <mutex>
+#include <array>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+
+#include "forms.h"
+#include "options.h"
+
+class FormRegistry
+{
+    struct Shard
+    {
+        std::mutex lock;
+        std::unordered_map<long long, std::unique_ptr<Form>> forms;
+    };
+
+    std::array<Shard, FORM_SHARDS> shards;
+
+public:
+    FormRegistry() { }
+
+    FormRegistry(const FormRegistry&) = delete;
+    FormRegistry& operator=(const FormRegistry&) = delete;
+
+    // Add a form, returning where it is. Throws if a form with this ID is
+    // already being processed.
+    Form* add(std::unique_ptr<Form> form);
+
+    // The form with this ID or nullptr if it doesn't exist
+    Form* find(long long id);
+
+    // Call the function with the form with this ID while it can't be removed,
+    // returning whether it exists
+    bool visit(long long id, const std::function<void(Form&)>& function);
+
+    // Call the function with every form, one shard at a time, so forms may be
+    // added or removed in other shards meanwhile
+    void visitAll(const std::function<void(Form&)>& function);
+
+    // Take the form out, nullptr if it doesn't exist
+    std::unique_ptr<Form> remove(long long id);
+
+private:
+    Shard& shard(long long id);
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include <sstream>
+#include <algorithm>
 
 #include "forms.h"
 
@@ -17,35 +18,57 @@ void Form::log(const std::string& msg, const LogType& t)
     std::ostringstream s;
     s << t << ": " << msg << std::endl;
 
+    if (journal)
+        journal->log(id, s.str());
+
     std::unique_lock<std::mutex> lock(output_mutex);
     output += s.str();
 }
 
-Form::Form(Form&& f)
-    : id(f.id), key(f.key), pages(f.pages), processor(f.processor)
+bool Form::isResumed(long long index) const
 {
-    filename = std::move(f.filename);
-    formImages = std::move(f.formImages);
-
-    {
-        std::unique_lock<std::mutex> lock1(f.done_mutex);
-        done = f.done;
-    }
-
-    {
-        std::unique_lock<std::mutex> lock2(f.output_mutex);
-        output = std::move(f.output);
-    }
+    return resumed.find(index) != resumed.end();
 }
 
-void Form::incDone()
+bool Form::incDone()
 {
-    std::unique_lock<std::mutex> lock(done_mutex);
+    // Both incDone() and setPages() might see all the pages done, but only
+    // the one whose update brings remaining to zero finishes the form
     ++done;
+    return --remaining == 0;
+}
+
+void Form::setDone(long long d)
+{
+    done = d;
+    remaining -= d;
 }
 
 long long Form::getDone()
 {
-    std::unique_lock<std::mutex> lock(done_mutex);
     return done;
 }
+
+bool Form::setPages(long long p)
+{
+    pages = p;
+    return (remaining += p - UnknownPages) == 0;
+}
+
+long long Form::getPages()
+{
+    return pages;
+}
+
+double Form::progress(long long more)
+{
+    const long long finished = done + more;
+
+    // We haven't extracted all of them yet, so we can't be done
+    long long total = pages;
+
+    if (total < 0)
+        total = std::max(expected.load(), finished+1);
+
+    return (total > 0)?1.0*finished/total:1;
+}
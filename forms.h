@@ -5,6 +5,7 @@
 #ifndef H_FORMS
 #define H_FORMS
 
+#include <set>
 #include <list>
 #include <mutex>
 #include <atomic>
@@ -14,14 +15,25 @@
 #include "log.h"
 #include "data.h"
 #include "pixels.h"
+#include "journal.h"
 
 struct Form;
 class Processor;
 
+// What to keep of each page once it has been parsed. Only the ID and answers
+// are needed to grade the form.
+enum class Retain
+{
+    Results,    // Drop the image
+    Thumbnail,  // Keep a small copy of the image for later review
+    Image       // Keep the whole image
+};
+
 // For each image in each PDF
 struct FormImage
 {
-    // Image to process
+    // Image to process, which after processing is either empty, a
+    // thumbnail, or the original depending on the processor's Retain mode
     Pixels image;
 
     // Reference to parent, used to log messages
@@ -32,8 +44,20 @@ struct FormImage
     long long thread_id;
     std::vector<Answer> answers;
 
-    FormImage(Form& form, Pixels&& image)
-        : image(image), form(form), id(-1), thread_id(-1)
+    // Bytes reserved in the processor's memory budget for the image
+    long long reserved;
+
+    // Which image in the PDF this is, used to skip pages already done when
+    // resuming after a restart
+    long long index;
+
+    // Hash of the image's data if caching results
+    std::string hash;
+
+    FormImage(Form& form, Pixels&& image, long long reserved = 0,
+            long long index = -1)
+        : image(std::move(image)), form(form), id(-1), thread_id(-1), reserved(reserved),
+          index(index)
     { }
 };
 
@@ -42,12 +66,27 @@ struct Form
 {
     long long id;
     long long key;
-    long long pages;
     std::string filename;
 
-    // Forms processed
-    long long done;
-    std::mutex done_mutex;
+    // Hash of the PDF if caching results
+    std::string hash;
+
+    // Pages processed and total pages, which is -1 until we've extracted all
+    // of the images since we start parsing pages as they are decoded
+    std::atomic<long long> done;
+    std::atomic<long long> pages;
+
+    // Pages still to be processed, counting down from UnknownPages till we
+    // know how many there are. Whoever brings it to zero finishes the form,
+    // which may delete it, so nobody looks at the form after changing this.
+    std::atomic<long long> remaining;
+
+    // Set if the form was deleted, so we stop processing it as soon as we can
+    std::atomic_bool canceled;
+
+    // Estimate of the total pages (e.g. the PDF page count) for displaying
+    // progress before we know how many images there actually are
+    std::atomic<long long> expected;
 
     // For thread-safe log messages
     std::string output;
@@ -57,43 +96,55 @@ struct Form
     std::list<FormImage> formImages;
     std::mutex images_mutex;
 
-    // Reference to parent
-    Processor& processor;
+    // Indices of the images parsed before we were restarted, which we don't
+    // need to decode again
+    std::set<long long> resumed;
 
-    Form(Processor& processor)
-        : id(-1), key(0), pages(-1), done(0), processor(processor)
-    { }
+    // Where to record progress, nullptr if not journaling
+    Journal* journal;
 
-    Form(Form&&);
+    // Reference to parent
+    Processor& processor;
 
     Form(long long id, long long key, const std::string& filename,
             Processor& processor)
-        : id(id), key(key), pages(-1), filename(filename), done(0), processor(processor)
+        : id(id), key(key), filename(filename), done(0), pages(-1),
+          remaining(UnknownPages), canceled(false), expected(0), journal(nullptr),
+          processor(processor)
     {
     }
 
-    // Increment or get how many forms we've done
-    void incDone();
+    Form(const Form&) = delete;
+    Form& operator=(const Form&) = delete;
+
+    // Increment or get how many pages we've done. Returns true if this was
+    // the last page and we know how many pages there are, in which case the
+    // caller finishes the form. Otherwise, the form may be finished and
+    // deleted by another thread as soon as this returns.
+    bool incDone();
     long long getDone();
 
-    void log(const std::string& msg, const LogType& t = LogType::Error);
-};
+    // Count the pages done before we were restarted, before parsing any
+    void setDone(long long done);
 
-// Used for searching for the form with a certain ID
-class FormPredicate
-{
-    long long id;
+    // Set the number of pages once all are extracted. Returns true if all of
+    // them have already been processed, with the same caveat as incDone().
+    bool setPages(long long pages);
+    long long getPages();
 
-public:
-    FormPredicate(long long id)
-        : id(id)
-    {
-    }
+    // Fraction of the pages done, plus this many more, using the estimate if
+    // we don't know how many pages there are yet
+    double progress(long long more = 0);
 
-    bool operator()(const Form& f)
-    {
-        return f.id == id;
-    }
+    // Was this image already parsed before a restart?
+    bool isResumed(long long index) const;
+
+    void log(const std::string& msg, const LogType& t = LogType::Error);
+
+private:
+    // More pages than any form has, so remaining can't reach zero before
+    // setPages() takes it off
+    static const long long UnknownPages = 1LL << 48;
 };
 
 // Equality based on if IDs are equal
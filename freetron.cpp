@@ -5,13 +5,14 @@
  *   - Statistics (e.g. most missed, least missed, ...?) as text and/or images
  *   - Generalize for any style of form, make forms/type*.xml and autodetect
  *   - When a box is missing, calculate supposed position
- *   - Pick largest image on the page of a PDF
  *   - Rotate based on a few boxes in line, then find all boxes
  *   - Auto-adjusting HEIGHT_ERROR and MIN_BLACK
  */
 
 #include <atomic>
+#include <memory>
 #include <string>
+#include <vector>
 #include <cstring>
 #include <cstdlib>
 #include <fstream>
@@ -29,6 +30,10 @@
 #include <booster/intrusive_ptr.h>
 
 #include "read.h"
+#include "batch.h"
+#include "spool.h"
+#include "watch.h"
+#include "decoders.h"
 #include "options.h"
 #include "processor.h"
 #include "website/rpc.h"
@@ -43,6 +48,9 @@ bool DEBUG = false;
 static std::atomic_bool signal_sighup;
 static cppcms::service* signal_srv;
 
+// Stop watching a directory or taking jobs from a spool on SIGINT or SIGTERM
+static std::atomic_bool signal_stop;
+
 void signal_handler(int signal)
 {
     if (signal == SIGHUP)
@@ -52,6 +60,10 @@ void signal_handler(int signal)
         if (signal_srv)
             signal_srv->shutdown();
     }
+    else if (signal == SIGINT || signal == SIGTERM)
+    {
+        signal_stop = true;
+    }
 }
 
 enum class Args
@@ -65,29 +77,52 @@ enum class Args
     Daemon,
     SiteConfig,
     Max,
-    CSV
+    CSV,
+    Memory,
+    Retain,
+    Manifest,
+    Output,
+    Watch,
+    Spool,
+    Worker,
+    Pin,
+    Decoders
 };
 
 void help()
 {
     std::cerr << "Usage" << std::endl
               << "  freetron [options] --daemon website/" << std::endl
-              << "  freetron [options] -i KeyID form.pdf" << std::endl
+              << "  freetron [options] -i KeyID form.pdf [more.tif forms/ ...]" << std::endl
+              << "  freetron [options] --manifest forms.txt" << std::endl
+              << "  freetron [options] --watch scans/" << std::endl
+              << "  freetron [options] --worker spool/" << std::endl
               << std::endl
               << "General Options" << std::endl
               << "  -h, --help         show this message" << std::endl
               << "  -t, --threads 8    max number of threads to create" << std::endl
+              << "  --pin              keep each thread on one CPU" << std::endl
+              << "  --decoders 4       decode images in this many processes" << std::endl
+              << "  -m, --memory 2048  max megabytes for pages in progress, 0 is no max" << std::endl
+              << "  --retain results   after a page: results, thumbnail, or image" << std::endl
               << std::endl
               << "Command Line" << std::endl
               << "  -i, --id  1234     ID of form to use as the key" << std::endl
               << "  -d, --debug        output debug images" << std::endl
               << "  -c, --csv          output CSV file instead of summary" << std::endl
+              << "  --manifest list    file with a \"form.pdf KeyID\" on each line" << std::endl
+              << "  -o, --output dir/  write each form's results to dir/form.pdf.csv" << std::endl
+              << "  --watch scans/     grade scans as they're added, results in scans/done/" << std::endl
               << std::endl
               << "Website" << std::endl
               << "  --daemon website/  run the website, don't exit till Ctrl+C" << std::endl
               << "  --config conf.js   alternate config (no path)" << std::endl
               << "  --db sqlite.db     alternate database (no path)" << std::endl
-              << "  --max 250          max upload filesize in megabytes" << std::endl;
+              << "  --max 250          max upload filesize in megabytes" << std::endl
+              << "  --spool spool/     leave processing to workers using this spool" << std::endl
+              << std::endl
+              << "Worker" << std::endl
+              << "  --worker spool/    process forms the website adds to this spool" << std::endl;
 }
 
 void invalid()
@@ -98,22 +133,40 @@ void invalid()
 
 int main(int argc, char* argv[])
 {
+    // We're one of the decoder processes started by DecoderPool
+    if (argc == 3 && std::strcmp(argv[1], "--decoder") == 0)
+        return decoderMain(std::atoi(argv[2]));
+
     // Argument parsing
     std::string path;
-    std::string filename;
+    std::string manifest;
+    std::string outputDir;
+    std::string watch;
+    std::string spoolDir;
+    std::string worker;
+    std::vector<std::string> filenames;
     std::string siteconfig = "config.js";
     std::string database = "sqlite.db";
     bool csv = false;
     bool daemon = false;
     int threads = 0; // 0 == number of cores
+    bool pin = false;
+    int decoders = 0; // 0 == decode in this process
     long long key = DefaultID;
     long long maxFilesize = 250*1024*1024;
+    long long memoryLimit = 0; // 0 == no limit
+    Retain retain = Retain::Results;
 
     std::map<std::string, Args> options = {{
         { "-h",        Args::Help },
         { "--help",    Args::Help },
         { "-t",        Args::Threads },
         { "--threads", Args::Threads },
+        { "--pin",     Args::Pin },
+        { "--decoders", Args::Decoders },
+        { "-m",        Args::Memory },
+        { "--memory",  Args::Memory },
+        { "--retain",  Args::Retain },
 
         // Daemon specific
         { "-i",        Args::ID },
@@ -122,12 +175,20 @@ int main(int argc, char* argv[])
         { "--debug",   Args::Debug },
         { "-c",        Args::CSV },
         { "--csv",     Args::CSV },
+        { "--manifest", Args::Manifest },
+        { "-o",        Args::Output },
+        { "--output",  Args::Output },
+        { "--watch",   Args::Watch },
 
         // Website specific
         { "--daemon",  Args::Daemon },
         { "--config",  Args::SiteConfig },
         { "--db",      Args::DB },
-        { "--max",     Args::Max }
+        { "--max",     Args::Max },
+        { "--spool",   Args::Spool },
+
+        // Worker specific
+        { "--worker",  Args::Worker }
     }};
 
     for (int i = 1; i < argc; ++i)
@@ -179,12 +240,112 @@ int main(int argc, char* argv[])
                     return 1;
                 }
                 break;
+            case Args::Memory:
+                ++i;
+
+                if (i == argc)
+                    invalid();
+
+                try
+                {
+                    memoryLimit = std::stoll(argv[i])*1024*1024;
+                }
+                catch (const std::invalid_argument&)
+                {
+                    std::cerr << "Error: invalid memory limit" << std::endl;
+                    return 1;
+                }
+                catch (const std::out_of_range&)
+                {
+                    std::cerr << "Error: memory limit too large" << std::endl;
+                    return 1;
+                }
+                break;
+            case Args::Pin:
+                pin = true;
+                break;
+            case Args::Decoders:
+                ++i;
+
+                if (i == argc)
+                    invalid();
+
+                try
+                {
+                    decoders = std::stoi(argv[i]);
+                }
+                catch (const std::invalid_argument&)
+                {
+                    std::cerr << "Error: invalid number of decoders" << std::endl;
+                    return 1;
+                }
+                catch (const std::out_of_range&)
+                {
+                    std::cerr << "Error: number of decoders too large" << std::endl;
+                    return 1;
+                }
+                break;
+            case Args::Retain:
+                ++i;
+
+                if (i == argc)
+                    invalid();
+
+                if (std::strcmp(argv[i], "results") == 0)
+                    retain = Retain::Results;
+                else if (std::strcmp(argv[i], "thumbnail") == 0)
+                    retain = Retain::Thumbnail;
+                else if (std::strcmp(argv[i], "image") == 0)
+                    retain = Retain::Image;
+                else
+                    invalid();
+                break;
             case Args::Debug:
                 DEBUG = true;
                 break;
             case Args::CSV:
                 csv = true;
                 break;
+            case Args::Manifest:
+                ++i;
+
+                if (i == argc)
+                    invalid();
+
+                manifest = argv[i];
+                break;
+            case Args::Output:
+                ++i;
+
+                if (i == argc)
+                    invalid();
+
+                outputDir = argv[i];
+                break;
+            case Args::Watch:
+                ++i;
+
+                if (i == argc)
+                    invalid();
+
+                watch = argv[i];
+                break;
+            case Args::Spool:
+                ++i;
+
+                if (i == argc)
+                    invalid();
+
+                spoolDir = argv[i];
+                break;
+            case Args::Worker:
+                ++i;
+
+                if (i == argc)
+                    invalid();
+
+                worker = argv[i];
+                break;
             case Args::Daemon:
                 ++i;
                 daemon = true;
@@ -232,16 +393,18 @@ int main(int argc, char* argv[])
                 }
                 break;
             default:
-                if (!filename.empty())
-                    invalid();
-
-                filename = argv[i];
+                filenames.push_back(argv[i]);
                 break;
         }
     }
 
 
-    if (key == DefaultID && !daemon)
+    if (!daemon && filenames.empty() && manifest.empty() && watch.empty() &&
+        worker.empty())
+        invalid();
+
+    // Forms in the manifest and watched folder have their own keys
+    if (key == DefaultID && !daemon && !filenames.empty())
     {
         std::cerr << "Error: key ID cannot be the default ID" << std::endl;
         return 1;
@@ -250,19 +413,109 @@ int main(int argc, char* argv[])
     ilInit();
     srand(time(NULL));
 
-    if (!daemon)
+    // Start these before any threads so there's less to copy when forking
+    if (decoders > 0)
+        DecoderPool::start(decoders);
+
+    if (!worker.empty())
+    {
+        // Stop taking jobs on Ctrl+C, but finish the ones we took
+        struct sigaction sa;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = 0;
+        sa.sa_handler = &signal_handler;
+        signal_stop = false;
+
+        if (sigaction(SIGINT, &sa, NULL) == -1 || sigaction(SIGTERM, &sa, NULL) == -1)
+            std::cout << "Warning: not handling SIGINT or SIGTERM" << std::endl;
+
+        try
+        {
+            Spool spool(worker);
+            Database db;
+            Processor p(threads, false, db, memoryLimit, retain, pin);
+
+            SpoolWorker(p, spool).run(signal_stop);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else if (!watch.empty())
+    {
+        struct stat info;
+
+        if (!outputDir.empty() && (stat(outputDir.c_str(), &info) != 0 ||
+                    !(info.st_mode&S_IFDIR)))
+        {
+            std::cerr << "Error: couldn't find output directory " << outputDir << std::endl;
+            return 1;
+        }
+
+        // Stop taking new scans on Ctrl+C, but finish the ones we took
+        struct sigaction sa;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = 0;
+        sa.sa_handler = &signal_handler;
+        signal_stop = false;
+
+        if (sigaction(SIGINT, &sa, NULL) == -1 || sigaction(SIGTERM, &sa, NULL) == -1)
+            std::cout << "Warning: not handling SIGINT or SIGTERM" << std::endl;
+
+        Database db;
+        Processor p(threads, false, db, memoryLimit, retain, pin);
+
+        try
+        {
+            HotFolder folder(p, watch, key, csv, outputDir);
+            folder.run(signal_stop);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else if (!daemon)
     {
+        std::vector<BatchForm> forms;
+
+        try
+        {
+            for (const std::string& filename : filenames)
+                addPath(forms, filename, key);
+
+            if (!manifest.empty())
+                readManifest(forms, manifest);
+
+            struct stat info;
+
+            if (!outputDir.empty() && (stat(outputDir.c_str(), &info) != 0 ||
+                        !(info.st_mode&S_IFDIR)))
+                throw std::runtime_error("couldn't find output directory " + outputDir);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+
         Database db;
-        Processor p(threads, false, db);
+        Processor p(threads, false, db, memoryLimit, retain, pin);
 
-        // Process a single form and exit
-        p.add(0, key, filename);
-        p.wait();
+        // Write out each form as soon as it's done. With more than one, say
+        // which form the results are from.
+        BatchOutput output(csv, outputDir, std::cout, forms.size() > 1);
+        p.onFinish([&output, &p](Form& form) { output.write(p, form); });
 
-        if (csv)
-            std::cout << p.csv(0);
-        else
-            std::cout << p.print(0);
+        // Process all the forms and exit. The pages of all the forms share
+        // the same threads.
+        for (std::vector<BatchForm>::size_type i = 0; i < forms.size(); ++i)
+            p.add(i, forms[i].key, forms[i].filename);
+
+        p.wait();
     }
     else
     {
@@ -287,8 +540,20 @@ int main(int argc, char* argv[])
             // Init database
             Database db(database);
 
+            // Workers do the processing if we have a spool
+            std::unique_ptr<Spool> spool;
+
+            if (!spoolDir.empty())
+                spool.reset(new Spool(spoolDir));
+
             // Init application
-            Processor p(threads, true, db);
+            Processor p(threads, true, db, memoryLimit, retain, pin);
+
+            if (spool)
+                p.useSpool(*spool);
+
+            // Pick up where we left off if we were killed or restarted
+            p.resume();
 
             // Loop on SIGHUP, but exit on SIGTERM or SIGINT (handled by CppCMS)
             struct sigaction sa;
@@ -4,18 +4,15 @@
 #include "options.h"
 #include "histogram.h"
 
-Histogram::Histogram(const std::vector<std::vector<unsigned char>>& img)
+Histogram::Histogram(const unsigned char* img, std::size_t size)
     : graph(256, 0) // This is unsigned char, so there's 0-255
 {
-    int h = img.size();
-    int w = (h>0)?img[0].size():0;
-    total = w*h;
+    total = size;
 
     // Generate the graph by counting how many pixels are each shade. This
     // is easy with discrete values, would be more interesting with doubles.
-    for (int y = 0; y < h; ++y)
-        for (int x = 0; x < w; ++x)
-            ++graph[img[y][x]];
+    for (std::size_t i = 0; i < size; ++i)
+        ++graph[img[i]];
 }
 
 // This simple algorithm worked just as good and executed faster than some
@@ -34,3 +31,29 @@ unsigned char Histogram::threshold(unsigned char initial) const
 
     return initial;
 }
+
+bool Histogram::bilevel(unsigned char& threshold) const
+{
+    int dark = -1;
+    int light = -1;
+
+    for (int shade = 0; shade < static_cast<int>(graph.size()); ++shade)
+    {
+        if (graph[shade] == 0)
+            continue;
+
+        if (dark < 0)
+            dark = shade;
+        else if (light < 0)
+            light = shade;
+        else
+            return false;
+    }
+
+    if (light < 0)
+        return false;
+
+    // Black is below the threshold
+    threshold = light;
+    return true;
+}
@@ -7,6 +7,7 @@
 #define H_HISTOGRAM
 
 #include <vector>
+#include <cstddef>
 
 class Histogram
 {
@@ -14,12 +15,16 @@ class Histogram
     std::vector<int> graph;
 
 public:
-    // Each inner vector is assumed to have the same length
-    Histogram(const std::vector<std::vector<unsigned char>>& img);
+    // All the pixels of the image, the order doesn't matter
+    Histogram(const unsigned char* img, std::size_t size);
 
     // Auto threshold. Specify the initial threshold to use to determine the
     // foreground and background.
     unsigned char threshold(unsigned char initial) const;
+
+    // Whether there are exactly two shades, e.g. a computer-generated image,
+    // and if so set threshold so the darker is black and the lighter white
+    bool bilevel(unsigned char& threshold) const;
 };
 
 #endif
@@ -0,0 +1,322 @@
+#include <map>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "journal.h"
+#include "options.h"
+
+static const std::string JOURNAL_EXTENSION = ".journal";
+
+// Log messages may have new lines, but each record needs to be on one line
+static std::string escape(const std::string& s)
+{
+    std::string result;
+    result.reserve(s.size());
+
+    for (char c : s)
+    {
+        if (c == '\\')
+            result += "\\\\";
+        else if (c == '\n')
+            result += "\\n";
+        else
+            result += c;
+    }
+
+    return result;
+}
+
+static std::string unescape(const std::string& s)
+{
+    std::string result;
+    result.reserve(s.size());
+
+    for (std::string::size_type i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '\\' && i+1 < s.size())
+        {
+            ++i;
+            result += (s[i] == 'n')?'\n':s[i];
+        }
+        else
+        {
+            result += s[i];
+        }
+    }
+
+    return result;
+}
+
+Journal::Journal(const std::string& dir)
+    : dir(dir), stopping(false)
+{
+    if (!enabled())
+        return;
+
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+        throw std::runtime_error("couldn't create journal directory " + dir);
+
+    writer = std::thread(&Journal::sync, this);
+}
+
+Journal::~Journal()
+{
+    {
+        std::unique_lock<std::mutex> lck(lock);
+        stopping = true;
+    }
+
+    changed.notify_all();
+
+    if (writer.joinable())
+        writer.join();
+}
+
+std::string Journal::path(long long id) const
+{
+    return dir + "/" + std::to_string(id) + JOURNAL_EXTENSION;
+}
+
+void Journal::append(long long id, const std::string& line, Record::Type type)
+{
+    if (!enabled())
+        return;
+
+    {
+        std::unique_lock<std::mutex> lck(lock);
+        queued.push_back(Record(id, type, line));
+    }
+
+    changed.notify_one();
+}
+
+void Journal::sync()
+{
+    std::unique_lock<std::mutex> lck(lock);
+
+    while (true)
+    {
+        changed.wait(lck, [this]() { return stopping || !queued.empty(); });
+
+        if (queued.empty())
+            break;
+
+        // Let the other pages being parsed add theirs so we sync them all
+        // at once
+        if (!stopping)
+            changed.wait_for(lck, std::chrono::milliseconds(JOURNAL_SYNC_MS),
+                    [this]() { return stopping; });
+
+        std::vector<Record> records;
+        records.swap(queued);
+
+        lck.unlock();
+        write(records);
+        lck.lock();
+    }
+}
+
+void Journal::write(const std::vector<Record>& records)
+{
+    // Files opened for this batch, synced once we've written everything
+    std::map<long long, int> files;
+
+    for (const Record& record : records)
+    {
+        const std::string filename = path(record.id);
+        std::map<long long, int>::iterator file = files.find(record.id);
+
+        if (record.type == Record::Remove)
+        {
+            if (file != files.end())
+            {
+                close(file->second);
+                files.erase(file);
+            }
+
+            if (std::remove(filename.c_str()) != 0)
+                ::log("couldn't delete journal " + filename);
+
+            continue;
+        }
+
+        // Start over if it was already open, e.g. from an earlier form that
+        // had the same ID
+        if (file != files.end() && record.type == Record::Create)
+        {
+            close(file->second);
+            files.erase(file);
+            file = files.end();
+        }
+
+        if (file == files.end())
+        {
+            const int flags = O_WRONLY | O_CREAT | O_APPEND |
+                ((record.type == Record::Create)?O_TRUNC:0);
+            const int fd = open(filename.c_str(), flags, 0644);
+
+            if (fd == -1)
+            {
+                ::log("couldn't open journal " + filename);
+                continue;
+            }
+
+            file = files.insert(std::make_pair(record.id, fd)).first;
+        }
+
+        const std::string line = record.line + "\n";
+
+        // If this fails, we'll just process the page again after a restart
+        if (::write(file->second, line.c_str(), line.size()) !=
+                static_cast<ssize_t>(line.size()))
+            ::log("couldn't write to journal " + filename);
+    }
+
+    for (const std::pair<const long long, int>& file : files)
+    {
+        if (fsync(file.second) != 0)
+            ::log("couldn't write to journal " + path(file.first));
+
+        close(file.second);
+    }
+}
+
+void Journal::add(long long id, long long key, const std::string& filename)
+{
+    std::ostringstream s;
+    s << "form " << key << " " << escape(filename);
+    append(id, s.str(), Record::Create);
+}
+
+void Journal::page(long long id, long long index, long long studentId,
+        const std::vector<Answer>& answers)
+{
+    std::ostringstream s;
+    s << "page " << index << " " << studentId << " " << answers.size();
+
+    for (const Answer& a : answers)
+        s << " " << static_cast<int>(a);
+
+    append(id, s.str());
+}
+
+void Journal::pages(long long id, long long count)
+{
+    append(id, "pages " + std::to_string(count));
+}
+
+void Journal::log(long long id, const std::string& msg)
+{
+    append(id, "log " + escape(msg));
+}
+
+void Journal::remove(long long id)
+{
+    // After whatever's still queued for it, so that doesn't bring it back
+    append(id, "", Record::Remove);
+}
+
+std::vector<JournalForm> Journal::recover() const
+{
+    std::vector<JournalForm> forms;
+
+    if (!enabled())
+        return forms;
+
+    DIR* d = opendir(dir.c_str());
+
+    if (!d)
+        return forms;
+
+    while (dirent* entry = readdir(d))
+    {
+        const std::string name = entry->d_name;
+
+        if (name.size() <= JOURNAL_EXTENSION.size() ||
+            name.compare(name.size() - JOURNAL_EXTENSION.size(),
+                JOURNAL_EXTENSION.size(), JOURNAL_EXTENSION) != 0)
+            continue;
+
+        std::ifstream file(dir + "/" + name);
+        std::string line;
+
+        // Since the last line may have been cut off, only use lines that
+        // parse completely, and don't use a form we don't know the file for
+        JournalForm form(std::atoll(name.c_str()));
+        bool found = false;
+
+        while (std::getline(file, line))
+        {
+            // Ended before the newline, so we died while writing it
+            if (file.eof())
+                break;
+
+            std::istringstream s(line);
+            std::string type;
+            s >> type;
+
+            if (type == "form")
+            {
+                std::string filename;
+
+                if (s >> form.key && s.get() == ' ' && std::getline(s, filename))
+                {
+                    form.filename = unescape(filename);
+                    found = true;
+                }
+            }
+            else if (type == "page")
+            {
+                long long index;
+                long long studentId;
+                std::vector<Answer>::size_type count;
+
+                if (!(s >> index >> studentId >> count))
+                    continue;
+
+                JournalPage page(index, studentId);
+
+                for (std::vector<Answer>::size_type i = 0; i < count; ++i)
+                {
+                    int a;
+
+                    if (!(s >> a))
+                        break;
+
+                    page.answers.push_back(static_cast<Answer>(a));
+                }
+
+                if (page.answers.size() == count)
+                    form.done.push_back(page);
+            }
+            else if (type == "pages")
+            {
+                s >> form.pages;
+            }
+            else if (type == "log")
+            {
+                std::string msg;
+
+                if (s.get() == ' ' && std::getline(s, msg))
+                    form.output += unescape(msg);
+            }
+        }
+
+        if (found)
+            forms.push_back(form);
+    }
+
+    closedir(d);
+
+    return forms;
+}
@@ -0,0 +1,146 @@
+/*
+ * On-disk journal of the forms being processed so that if we're killed or
+ * restarted, we can pick up where we left off rather than reprocessing every
+ * page of every form.
+ *
+ * Each form gets its own file in the journal directory, appended to as the
+ * form is processed and deleted once the results are in the database:
+ *
+ *   form <key> <filename>
+ *   page <index> <id> <answer count> <answers...>
+ *   log <message>
+ *   pages <count>
+ *
+ * Lines are queued and written by one thread, which syncs each file once for
+ * all the lines added in the last JOURNAL_SYNC_MS, so processing never waits
+ * on the disk. If we die, at most those lines are lost, and those pages are
+ * processed again.
+ *
+ * Example:
+ *
+ *   Journal journal("journal");
+ *   for (const JournalForm& f : journal.recover()) { }
+ *   journal.add(id, key, filename);
+ *   journal.page(id, index, studentId, answers);
+ *   journal.remove(id);
+ */
+
+#ifndef H_JOURNAL
+#define H_JOURNAL
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "data.h"
+
+// A page that was done before we were restarted
+struct JournalPage
+{
+    long long index;
+    long long id;
+    std::vector<Answer> answers;
+
+    JournalPage(long long index, long long id)
+        : index(index), id(id)
+    {
+    }
+};
+
+// Everything we knew about a form before we were restarted
+struct JournalForm
+{
+    long long id;
+    long long key;
+    std::string filename;
+
+    // -1 if we hadn't extracted all the images yet
+    long long pages;
+
+    std::vector<JournalPage> done;
+    std::string output;
+
+    JournalForm(long long id)
+        : id(id), key(0), pages(-1)
+    {
+    }
+};
+
+class Journal
+{
+    // A line to write, or the file to delete
+    struct Record
+    {
+        enum Type { Create, Append, Remove };
+
+        long long id;
+        Type type;
+        std::string line;
+
+        Record(long long id, Type type, const std::string& line = "")
+            : id(id), type(type), line(line)
+        {
+        }
+    };
+
+    // Empty if not journaling
+    std::string dir;
+
+    // What's been added but not written yet
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<Record> queued;
+    bool stopping;
+    std::thread writer;
+
+public:
+    // Journal to files in this directory, creating it if needed. If the
+    // directory is empty, nothing is written.
+    Journal(const std::string& dir = "");
+
+    // Writes everything added so far first
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    bool enabled() const { return !dir.empty(); }
+
+    // Read all the forms left from the last time we ran. Ignores any partially
+    // written lines.
+    std::vector<JournalForm> recover() const;
+
+    // Start a new journal for this form
+    void add(long long id, long long key, const std::string& filename);
+
+    // A page of this form is done
+    void page(long long id, long long index, long long studentId,
+            const std::vector<Answer>& answers);
+
+    // All the images are extracted
+    void pages(long long id, long long count);
+
+    // Something was written to the form's log
+    void log(long long id, const std::string& msg);
+
+    // The form is in the database, so we don't need its journal anymore
+    void remove(long long id);
+
+private:
+    std::string path(long long id) const;
+
+    // Queue a record for the writer thread
+    void append(long long id, const std::string& line,
+            Record::Type type = Record::Append);
+
+    // Write and sync whatever is queued till we're stopped, on the writer
+    // thread
+    void sync();
+
+    // Write these records to the forms' files, syncing each once
+    void write(const std::vector<Record>& records);
+};
+
+#endif
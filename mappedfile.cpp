@@ -0,0 +1,87 @@
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mappedfile.h"
+
+MemoryBuffer::MemoryBuffer(const char* data, std::size_t size)
+{
+    // We never write to it, so this is safe
+    char* p = const_cast<char*>(data);
+    setg(p, p, p + size);
+}
+
+MemoryBuffer::pos_type MemoryBuffer::seekoff(off_type off,
+    std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+    if (!(which & std::ios_base::in))
+        return pos_type(off_type(-1));
+
+    char* position;
+
+    if (dir == std::ios_base::beg)
+        position = eback() + off;
+    else if (dir == std::ios_base::cur)
+        position = gptr() + off;
+    else
+        position = egptr() + off;
+
+    if (position < eback() || position > egptr())
+        return pos_type(off_type(-1));
+
+    setg(eback(), position, egptr());
+    return pos_type(position - eback());
+}
+
+MemoryBuffer::pos_type MemoryBuffer::seekpos(pos_type pos,
+    std::ios_base::openmode which)
+{
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+MappedFile::MappedFile(const std::string& filename)
+    : map(open(filename, length)), buffer(map, length), in(&buffer)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    if (length > 0)
+        munmap(const_cast<char*>(map), length);
+}
+
+const char* MappedFile::open(const std::string& filename, std::size_t& length)
+{
+    length = 0;
+
+    int fd = ::open(filename.c_str(), O_RDONLY|O_CLOEXEC);
+
+    if (fd < 0)
+        throw std::runtime_error("couldn't open " + filename);
+
+    struct stat info;
+
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("couldn't get size of " + filename);
+    }
+
+    // Can't map an empty file, but there's nothing to read anyway
+    if (info.st_size == 0)
+    {
+        close(fd);
+        return "";
+    }
+
+    void* p = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED)
+        throw std::runtime_error("couldn't map " + filename);
+
+    length = info.st_size;
+    return static_cast<const char*>(p);
+}
@@ -0,0 +1,61 @@
+/*
+ * Read-only memory map of a file, also readable as a stream
+ *
+ * Used to parse PDFs straight from the page cache rather than reading them
+ * through a file stream. Only the parts of the file that are looked at are
+ * ever read from disk.
+ *
+ * Example:
+ *
+ *   MappedFile file("form.pdf");
+ *   std::string header(file.data(), 5);
+ *   file.stream().seekg(-32, std::ios::end);
+ */
+
+#ifndef H_MAPPEDFILE
+#define H_MAPPEDFILE
+
+#include <string>
+#include <istream>
+#include <streambuf>
+
+// A stream buffer reading from memory we don't own, without copying it
+class MemoryBuffer : public std::streambuf
+{
+public:
+    MemoryBuffer(const char* data, std::size_t size);
+
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+        std::ios_base::openmode which = std::ios_base::in);
+    pos_type seekpos(pos_type pos,
+        std::ios_base::openmode which = std::ios_base::in);
+};
+
+class MappedFile
+{
+    const char* map;
+    std::size_t length;
+    MemoryBuffer buffer;
+    std::istream in;
+
+public:
+    // Throws std::runtime_error if it can't be opened or mapped
+    MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return map; }
+    std::size_t size() const { return length; }
+
+    // Reads from the start of the map. Seeking works.
+    std::istream& stream() { return in; }
+
+private:
+    // Map the file, setting length. Used before buffer is constructed.
+    static const char* open(const std::string& filename, std::size_t& length);
+};
+
+#endif
@@ -1,6 +1,6 @@
 #include "math.h"
 
-Coord farthestFromPoint(const Coord& p, const std::vector<Coord>& points)
+Coord farthestFromPoint(const Coord& p, const ArenaVector<Coord>& points)
 {
     int dist = 0;
     Coord farthest;
@@ -19,7 +19,7 @@ Coord farthestFromPoint(const Coord& p, const std::vector<Coord>& points)
     return farthest;
 }
 
-Coord farthestFromPointSquare(const Coord& p, const std::vector<Coord>& points)
+Coord farthestFromPointSquare(const Coord& p, const ArenaVector<Coord>& points)
 {
     int dist = 0;
     Coord farthest;
@@ -39,7 +39,7 @@ Coord farthestFromPointSquare(const Coord& p, const std::vector<Coord>& points)
 }
 
 Coord farthestFromLine(const Coord& p1, const Coord& p2,
-    const std::vector<Coord>& points)
+    const ArenaVector<Coord>& points)
 {
     double dist = 0;
     Coord farthest;
@@ -85,7 +85,7 @@ Coord farthestFromLine(const Coord& p1, const Coord& p2,
 // Find the center. We move the origin to the first point so that the total x and y
 // values will fit in an int even at the far edges of the image. Then, later
 // we move it back to the proper spot.
-Coord findCenter(const std::vector<Coord>& points)
+Coord findCenter(const ArenaVector<Coord>& points)
 {
     if (points.size() == 0)
         return default_coord;
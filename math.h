@@ -11,6 +11,7 @@
 #include <algorithm>
 
 #include "data.h"
+#include "arena.h"
 
 static const double pi = 3.14159265358979323846264338327950;
 
@@ -40,19 +41,19 @@ inline Coord findMidpoint(const Coord& a, const Coord& b);
 
 // Used to find corners of boxes and bubbles
 Coord farthestFromPoint(const Coord& p,
-     const std::vector<Coord>& points);
+     const ArenaVector<Coord>& points);
 
 Coord farthestFromLine(const Coord& p1, const Coord& p2,
-     const std::vector<Coord>& points);
+     const ArenaVector<Coord>& points);
 
 // Instead of taking the diagonal distance for finding boxes, we can add the
 // horizontal and vertical distance. This will tend to get rid of the odd
 // extruded pixels on the side of a box.
 Coord farthestFromPointSquare(const Coord& p,
-     const std::vector<Coord>& points);
+     const ArenaVector<Coord>& points);
 
 // Determine "center" by averaging all points
-Coord findCenter(const std::vector<Coord>& points);
+Coord findCenter(const ArenaVector<Coord>& points);
 
 // Standard Deviation:
 //   sqrt(1/n*((x1 - avg)^2 + (x2 - avg)^2 + ... (xn - avg)^2))
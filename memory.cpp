@@ -0,0 +1,67 @@
+#include "memory.h"
+
+long long planeBytes(long long width, long long height)
+{
+    // One byte per pixel
+    return width*height;
+}
+
+long long decodeBytes(long long width, long long height)
+{
+    // RGB in DevIL plus RGB when we copy it out
+    return 6*width*height;
+}
+
+long long analysisBytes(long long width, long long height)
+{
+    // Two int label planes at once when recalculating Blobs after rotating
+    // and the copy of the gray plane
+    return 2*sizeof(int)*width*height + planeBytes(width, height);
+}
+
+MemoryBudget::MemoryBudget(long long limit)
+    : limit(limit), used(0)
+{
+}
+
+bool MemoryBudget::tryReserve(long long bytes, long long headroom)
+{
+    std::unique_lock<std::mutex> lck(lock);
+
+    if (limit > 0 && used > 0 && used + bytes + headroom > limit)
+        return false;
+
+    used += bytes;
+    return true;
+}
+
+void MemoryBudget::force(long long bytes)
+{
+    std::unique_lock<std::mutex> lck(lock);
+    used += bytes;
+}
+
+void MemoryBudget::release(long long bytes)
+{
+    if (bytes == 0)
+        return;
+
+    {
+        std::unique_lock<std::mutex> lck(lock);
+        used -= bytes;
+    }
+
+    released.notify_all();
+}
+
+void MemoryBudget::waitForRelease(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lck(lock);
+    released.wait_for(lck, timeout);
+}
+
+long long MemoryBudget::usage()
+{
+    std::unique_lock<std::mutex> lck(lock);
+    return used;
+}
@@ -0,0 +1,64 @@
+/*
+ * Keep track of about how much memory the pages being processed are using so
+ * that we don't decode more pages than we have memory for.
+ *
+ * Example:
+ *
+ *   MemoryBudget budget(1024*1024*1024);
+ *   budget.reserve(planeBytes(w, h));    // blocks if over the limit
+ *   // decode the image
+ *   budget.release(planeBytes(w, h));
+ */
+
+#ifndef H_MEMORY
+#define H_MEMORY
+
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+// Estimates of how much memory each stage of processing a page will use. Not
+// exact, but it's the size of the planes that matter, not the small stuff.
+
+// The grayscale image in Pixels
+long long planeBytes(long long width, long long height);
+
+// While decoding, the library's copy of the image and our RGB copy of it
+long long decodeBytes(long long width, long long height);
+
+// While parsing, the labels in Blobs, the copy made when rotating, and the
+// second Blobs we make after rotating
+long long analysisBytes(long long width, long long height);
+
+class MemoryBudget
+{
+    // In bytes, 0 means no limit
+    const long long limit;
+    long long used;
+
+    std::mutex lock;
+    std::condition_variable released;
+
+public:
+    MemoryBudget(long long limit = 0);
+
+    // Reserve if it'll fit with room for headroom more bytes later, returning
+    // whether we did. This always succeeds if nothing is reserved so that a
+    // page larger than the limit can still be processed.
+    bool tryReserve(long long bytes, long long headroom = 0);
+
+    // Reserve even if we're over the limit. Used by stages that are going to
+    // free memory, since blocking them could block everything.
+    void force(long long bytes);
+
+    // Give back memory reserved by either of the above
+    void release(long long bytes);
+
+    // Block till some memory is released or the timeout
+    void waitForRelease(std::chrono::milliseconds timeout);
+
+    long long usage();
+    long long max() const { return limit; }
+};
+
+#endif
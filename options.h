@@ -7,6 +7,7 @@
 
 #include <string>
 #include <vector>
+#include <cstddef>
 
 #include "data.h"
 
@@ -21,6 +22,90 @@ extern bool DEBUG;
 static const int MARK_SIZE = 5;
 static const unsigned char MARK_COLOR = 127;
 
+// How many images of a PDF to read ahead of those already decoded, which
+// limits how many are decoded at once
+static const std::size_t EXTRACT_AHEAD = 16;
+
+// How many levels of form XObjects (which can include each other) to look
+// through for the images on a PDF page
+static const int MAX_XOBJECT_DEPTH = 4;
+
+// When keeping a thumbnail of each page after processing it instead of the
+// whole image, the largest the width or height of the thumbnail will be.
+static const int THUMBNAIL_SIZE = 256;
+
+// How many bytes of free page-sized buffers all threads together keep around
+// to reuse for the next pages. A page needs a few at once: the gray plane,
+// the copy when rotating, and the labels. With a memory limit, the pools get
+// at most 1/POOL_SHARE of it, taken out of what pages can reserve.
+static const long long POOL_BYTES = 256*1024*1024;
+static const int POOL_SHARE = 8;
+
+// Size of each block of memory the per-page arena allocates at once. Outlines,
+// bubbles, etc. for a page fit in a few of these.
+static const std::size_t ARENA_BLOCK = 64*1024;
+
+// Number of separately locked parts of the index of forms being processed
+static const std::size_t FORM_SHARDS = 16;
+
+// Where to keep track of the forms being processed on the website so we can
+// resume them after a restart, relative to the website directory
+static const std::string JOURNAL_DIR = "journal";
+
+// The journal is written by its own thread, which collects what's added for
+// this long and then writes and syncs it all at once
+static const int JOURNAL_SYNC_MS = 20;
+
+// Results of PDFs and pages we've already processed on the website, relative
+// to the website directory, and how many of each to keep. Entries beyond
+// that are removed every CACHE_PRUNE additions, least recently used first.
+static const std::string CACHE_DB = "cache.db";
+static const long long CACHE_PDFS = 10000;
+static const long long CACHE_PAGES = 200000;
+static const long long CACHE_PRUNE = 100;
+
+// When parsing pages, forms with at most this many pages get this many turns
+// for every turn larger forms get
+static const long long SMALL_FORM_PAGES = 10;
+static const int SMALL_FORM_WEIGHT = 4;
+
+// Limits on how much work the website takes on. Until we know how many pages
+// a PDF has, we guess from its size. With up to ADMIT_PAGES pages not yet
+// parsed, new forms are processed as usual. Up to ADMIT_DEFER_PAGES, they're
+// accepted but only decoded when nothing else is waiting. Beyond that, uploads
+// are refused and told to retry after between ADMIT_RETRY_MIN and
+// ADMIT_RETRY_MAX seconds, estimated assuming ADMIT_PAGE_SECONDS per page
+// until we've timed some.
+static const long long ADMIT_PAGE_BYTES = 100*1024;
+static const long long ADMIT_PAGES = 2000;
+static const long long ADMIT_DEFER_PAGES = 10000;
+static const int ADMIT_RETRY_MIN = 5;
+static const int ADMIT_RETRY_MAX = 600;
+static const double ADMIT_PAGE_SECONDS = 0.5;
+
+// Subdirectories of a watched folder for the scans we've claimed and are
+// grading, and for those that are done along with their results. Each
+// instance watching the folder touches its directory of claims every second,
+// so one not touched for WATCH_ABANDONED seconds is from an instance that
+// died, e.g. on another machine, and its scans are put back.
+static const std::string WATCH_CLAIMED = ".processing";
+static const std::string WATCH_DONE = "done";
+static const int WATCH_ABANDONED = 600;
+
+// Handing forms to worker processes through a spool directory. Each worker
+// works on up to SPOOL_FORMS forms at once and renews its leases every
+// SPOOL_HEARTBEAT seconds. A lease not renewed in SPOOL_LEASE seconds has
+// expired. Workers look for jobs and the website for results every
+// SPOOL_POLL_MS milliseconds.
+static const std::size_t SPOOL_FORMS = 2;
+static const long long SPOOL_HEARTBEAT = 5;
+static const long long SPOOL_LEASE = 60;
+static const int SPOOL_POLL_MS = 1000;
+
+// How long a decoder process may take to start or to decode one image before
+// it's assumed stuck, killed, and replaced
+static const int DECODER_TIMEOUT_MS = 60000;
+
 // Whether to write to a log file, and the file we will write to if true. If
 // enabled, the log messages written to the screen in debug mode will be
 // written to this file.
@@ -96,6 +181,29 @@ static const int MIN_HEIGHT = 5;
 // this should be a safe value.
 static const int MAX_ITERATIONS = MAX_DIAG*4;
 
+// Before processing a page, make sure it could be a form. Pages with less
+// than CLASSIFY_BLANK of the pixels black are blank, and with more than
+// CLASSIFY_DARK are a photo or an inverted scan. Every CLASSIFY_STEP-th row
+// and column is looked at for this. Otherwise, there have to be at least
+// CLASSIFY_MARKS boxes in the CLASSIFY_STRIP of the page along the left or
+// right edge. There are 44 down the side of the form.
+static const double CLASSIFY_BLANK = 0.002;
+static const double CLASSIFY_DARK = 0.6;
+static const int CLASSIFY_STEP = 4;
+static const double CLASSIFY_STRIP = 0.2;
+static const int CLASSIFY_MARKS = 20;
+
+// Computer-generated pages with the boxes lined up exactly with the pixels are
+// read by looking where the bubbles have to be. A bubble is filled in based on
+// how much of the middle ALIGNED_SAMPLE of its width is black. If less than
+// ALIGNED_OUTLINE of the rectangle it's drawn in is black, there's no bubble
+// there, so the page is done the usual way instead. A scanned page's boxes have
+// ragged edges, so if more than ALIGNED_MISSES of the runs that could be the
+// top of a box aren't before the first one that is, we don't look further.
+static const double ALIGNED_SAMPLE = 0.6;
+static const double ALIGNED_OUTLINE = 0.05;
+static const int ALIGNED_MISSES = 4;
+
 // As a fail-safe, quit after this many iterations
 static const int HIST_MAX = 10;
 
@@ -73,7 +73,7 @@ Outline::Outline(const Blobs& blobs, const Coord& point,
 // If we've been to pixel before, go back till we can go some place new.
 EdgePair Outline::findEdge(const Coord& p) const
 {
-    typedef std::vector<Coord>::size_type size_type;
+    typedef ArenaVector<Coord>::size_type size_type;
 
     int index = -1;
 
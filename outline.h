@@ -8,11 +8,10 @@
 #ifndef H_OUTLINE
 #define H_OUTLINE
 
-#include <set>
 #include <array>
-#include <vector>
 
 #include "data.h"
+#include "arena.h"
 #include "blobs.h"
 
 // Used to return both point to jump to (if we had to go back a ways
@@ -35,8 +34,8 @@ class Outline
     int label = Blobs::default_label;
 
     // Save the outline of this object
-    std::vector<Coord> path;
-    std::set<Coord> sortedpath; // Faster for contains a point check
+    ArenaVector<Coord> path;
+    ArenaSet<Coord> sortedpath; // Faster for contains a point check
 
     // Did we find the outline?
     bool found = false;
@@ -50,7 +49,7 @@ public:
 
     bool good() const { return found; }
 
-    const std::vector<Coord>& points() const { return path; }
+    const ArenaVector<Coord>& points() const { return path; }
 
 private:
     // Find the next pixel on edge by finding index of matrix used to move, or
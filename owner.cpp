@@ -0,0 +1,49 @@
+#include <cerrno>
+#include <csignal>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "owner.h"
+
+// Just the host part, without slashes so it can't make a path
+static std::string hostName()
+{
+    char host[256];
+
+    if (gethostname(host, sizeof(host)) != 0)
+        host[0] = '\0';
+
+    host[sizeof(host)-1] = '\0';
+
+    std::string name(host);
+    std::replace(name.begin(), name.end(), '/', '_');
+
+    return name.empty()?"localhost":name;
+}
+
+std::string ownerName()
+{
+    return hostName() + "-" + std::to_string(getpid());
+}
+
+bool ownerGone(const std::string& owner)
+{
+    const std::string::size_type dash = owner.find_last_of('-');
+
+    if (dash == std::string::npos || owner.substr(0, dash) != hostName())
+        return false;
+
+    long long pid;
+
+    try
+    {
+        pid = std::stoll(owner.substr(dash+1));
+    }
+    catch (const std::logic_error&)
+    {
+        return false;
+    }
+
+    return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+}
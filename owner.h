@@ -0,0 +1,19 @@
+/*
+ * Names for this process that are unique across the machines sharing a
+ * directory, used for spool leases and for the scans a watched folder has
+ * claimed, and whether the process with such a name is still running
+ */
+
+#ifndef H_OWNER
+#define H_OWNER
+
+#include <string>
+
+// Host and process ID, e.g. scanner1-2817
+std::string ownerName();
+
+// Whether the owner is on this machine and isn't running anymore. If it's on
+// another machine, we can't tell, so this is false.
+bool ownerGone(const std::string& owner);
+
+#endif
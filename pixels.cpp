@@ -1,8 +1,10 @@
 #include <cmath>
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 
 #include "math.h"
+#include "pool.h"
 #include "pixels.h"
 #include "histogram.h"
 
@@ -10,13 +12,15 @@
 std::mutex Pixels::lock;
 
 Pixels::Pixels()
-    :w(0), h(0), loaded(false), gray_shade(GRAY_SHADE)
+    :img(nullptr), w(0), h(0), loaded(false), gray_shade(GRAY_SHADE),
+     two_shades(false)
 {
 }
 
 // type is either IL_JPG, IL_TIF, or IL_PNM in this case
 Pixels::Pixels(ILenum type, const char* lump, const int size, const std::string& fn)
-    :w(0), h(0), loaded(false), fn(fn), gray_shade(GRAY_SHADE)
+    :img(nullptr), w(0), h(0), loaded(false), fn(fn), gray_shade(GRAY_SHADE),
+     two_shades(false)
 {
     // Only execute in one thread since DevIL/OpenIL doesn't support multithreading,
     // so use a unique lock here. But, we'll do a bit more that doesn't need to be
@@ -40,14 +44,17 @@ Pixels::Pixels(ILenum type, const char* lump, const int size, const std::string&
 
             // 3 because IL_RGB
             const int total = w*h*3;
-            unsigned char* data = new unsigned char[total];
+            BufferPool<unsigned char>& pool = BufferPool<unsigned char>::local();
+            std::vector<unsigned char> rgb = pool.get(total, 0);
+            unsigned char* data = rgb.data();
 
             ilCopyPixels(0, 0, 0, w, h, 1, IL_RGB, IL_UNSIGNED_BYTE, data);
 
             // Move data into a nicer format
             int x = 0;
             int y = 0;
-            p = std::vector<std::vector<unsigned char>>(h, std::vector<unsigned char>(w));
+            p = pool.get(w*h, 0);
+            img = p.data();
 
             // Start at third
             for (int i = 2; i < total; i+=3)
@@ -62,7 +69,7 @@ Pixels::Pixels(ILenum type, const char* lump, const int size, const std::string&
                 //  p[y][x] = smartFloor(0.2126*data[i-2] + 0.7152*data[i-1] + 0.0722*data[i]);
 
                 // Use the simplest. It doesn't seem to make a difference.
-                p[y][x] = smartFloor((1.0*data[i-2]+data[i-1]+data[i])/3);
+                p[y*w + x] = smartFloor((1.0*data[i-2]+data[i-1]+data[i])/3);
 
                 // Increase y every time we get to end of row
                 if (x+1 == w)
@@ -77,7 +84,7 @@ Pixels::Pixels(ILenum type, const char* lump, const int size, const std::string&
             }
 
             loaded = true;
-            delete[] data;
+            pool.put(std::move(rgb));
         }
         else
         {
@@ -88,10 +95,85 @@ Pixels::Pixels(ILenum type, const char* lump, const int size, const std::string&
         ilDeleteImages(1, &name);
     }
 
+    findShade();
+}
+
+Pixels::Pixels(int width, int height, std::vector<unsigned char>&& plane,
+        const std::string& fn)
+    :p(std::move(plane)), img(p.data()), w(width), h(height), loaded(true),
+     fn(fn), gray_shade(GRAY_SHADE), two_shades(false)
+{
+    if (w < 0 || h < 0 || p.size() != static_cast<std::size_t>(w)*h)
+        throw std::runtime_error("image plane doesn't match its dimensions");
+
+    findShade();
+}
+
+Pixels::Pixels(int width, int height, MappedPlane&& plane,
+        const std::string& fn)
+    :mapped(std::move(plane)), img(mapped.get()), w(width), h(height),
+     loaded(true), fn(fn), gray_shade(GRAY_SHADE), two_shades(false)
+{
+    if (!img || w < 0 || h < 0)
+        throw std::runtime_error("image plane doesn't match its dimensions");
+
+    findShade();
+}
+
+Pixels::Pixels(Pixels&& other)
+    :marks(std::move(other.marks)), p(std::move(other.p)),
+     mapped(std::move(other.mapped)), img(other.img), w(other.w), h(other.h),
+     loaded(other.loaded), fn(std::move(other.fn)),
+     gray_shade(other.gray_shade), two_shades(other.two_shades)
+{
+    other.img = nullptr;
+}
+
+void Pixels::findShade()
+{
     // After loading, determine the real gray shade to view this as a black and white
-    // image. We'll be using this constantly, so we might as well do it now.
-    const Histogram h(p);
-    gray_shade = h.threshold(gray_shade);
+    // image. We'll be using this constantly, so we might as well do it now. If
+    // there are only two shades, there's nothing to search for.
+    const Histogram histogram(img, static_cast<std::size_t>(w)*h);
+    two_shades = histogram.bilevel(gray_shade);
+
+    if (!two_shades)
+        gray_shade = histogram.threshold(gray_shade);
+}
+
+Pixels& Pixels::operator=(Pixels&& other)
+{
+    if (this != &other)
+    {
+        recycle();
+
+        marks = std::move(other.marks);
+        p = std::move(other.p);
+        mapped = std::move(other.mapped);
+        img = other.img;
+        other.img = nullptr;
+        w = other.w;
+        h = other.h;
+        loaded = other.loaded;
+        fn = std::move(other.fn);
+        gray_shade = other.gray_shade;
+        two_shades = other.two_shades;
+    }
+
+    return *this;
+}
+
+Pixels::~Pixels()
+{
+    recycle();
+}
+
+void Pixels::recycle()
+{
+    BufferPool<unsigned char>::local().put(std::move(p));
+    p.clear();
+    mapped.reset();
+    img = nullptr;
 }
 
 void Pixels::mark(const Coord& c, int size)
@@ -124,7 +206,7 @@ void Pixels::save(const std::string& filename, bool show_marks, bool dim, bool b
     unsigned char color = MARK_COLOR;
 
     // Work on a separate copy of this image
-    std::vector<std::vector<unsigned char>> copy = p;
+    std::vector<unsigned char> copy(img, img + w*h);
 
     // Converting both at once would be faster
     if (bw && dim)
@@ -133,14 +215,14 @@ void Pixels::save(const std::string& filename, bool show_marks, bool dim, bool b
 
         for (int y = 0; y < h; ++y)
             for (int x = 0; x < w; ++x)
-                copy[y][x] = (copy[y][x]>gray_shade)?255:170; // 255-255/3 = 170
+                copy[y*w + x] = (copy[y*w + x]>gray_shade)?255:170; // 255-255/3 = 170
     }
     // Convert to black and white
     else if (bw)
     {
         for (int y = 0; y < h; ++y)
             for (int x = 0; x < w; ++x)
-                copy[y][x] = (copy[y][x]>gray_shade)?255:0;
+                copy[y*w + x] = (copy[y*w + x]>gray_shade)?255:0;
     }
     // Dim the image
     else if (dim)
@@ -149,7 +231,7 @@ void Pixels::save(const std::string& filename, bool show_marks, bool dim, bool b
 
         for (int y = 0; y < h; ++y)
             for (int x = 0; x < w; ++x)
-                copy[y][x] = 170 + copy[y][x]/3; // 255-255/3 = 170
+                copy[y*w + x] = 170 + copy[y*w + x]/3; // 255-255/3 = 170
     }
 
     // Draw the marks on a copy of the image
@@ -161,20 +243,20 @@ void Pixels::save(const std::string& filename, bool show_marks, bool dim, bool b
             {
                 // Left
                 for (int i = m.coord.x; i > m.coord.x-m.size && i >= 0; --i)
-                    copy[m.coord.y][i] = color;
+                    copy[m.coord.y*w + i] = color;
                 // Right
                 for (int i = m.coord.x; i < m.coord.x+m.size && i < w; ++i)
-                    copy[m.coord.y][i] = color;
+                    copy[m.coord.y*w + i] = color;
                 // Up
                 for (int i = m.coord.y; i > m.coord.y-m.size && i >= 0; --i)
-                    copy[i][m.coord.x] = color;
+                    copy[i*w + m.coord.x] = color;
                 // Down
                 for (int i = m.coord.y; i < m.coord.y+m.size && i < h; ++i)
-                    copy[i][m.coord.x] = color;
+                    copy[i*w + m.coord.x] = color;
             }
             else
             {
-                copy[m.coord.y][m.coord.x] = color;
+                copy[m.coord.y*w + m.coord.x] = color;
             }
         }
     }
@@ -202,7 +284,7 @@ void Pixels::save(const std::string& filename, bool show_marks, bool dim, bool b
         for (int x = 0; x < w; ++x)
         {
             // Black or white for RGB
-            const unsigned char val = copy[y][x];
+            const unsigned char val = copy[y*w + x];
             data[pos]   = val;
             data[pos+1] = val;
             data[pos+2] = val;
@@ -224,6 +306,47 @@ void Pixels::save(const std::string& filename, bool show_marks, bool dim, bool b
     delete[] data;
 }
 
+Pixels Pixels::thumbnail(int size) const
+{
+    Pixels small;
+
+    if (!loaded || w == 0 || h == 0 || size <= 0)
+        return small;
+
+    // How many pixels in each direction go into one in the thumbnail
+    const int scale = std::max(1, smartCeil(1.0*std::max(w, h)/size));
+
+    small.w = smartCeil(1.0*w/scale);
+    small.h = smartCeil(1.0*h/scale);
+    small.fn = fn;
+    small.loaded = true;
+    small.gray_shade = gray_shade;
+    small.p = std::vector<unsigned char>(small.w*small.h);
+    small.img = small.p.data();
+
+    for (int y = 0; y < small.h; ++y)
+    {
+        for (int x = 0; x < small.w; ++x)
+        {
+            int total = 0;
+            int count = 0;
+
+            for (int j = y*scale; j < (y+1)*scale && j < h; ++j)
+            {
+                for (int i = x*scale; i < (x+1)*scale && i < w; ++i)
+                {
+                    total += img[j*w + i];
+                    ++count;
+                }
+            }
+
+            small.p[y*small.w + x] = (count>0)?total/count:0xff;
+        }
+    }
+
+    return small;
+}
+
 Coord Pixels::rotatePoint(const Coord& origin, const Coord& c, double sin_rad, double cos_rad) const
 {
     // Translate to origin
@@ -247,7 +370,8 @@ Coord Pixels::rotatePoint(const Coord& origin, const Coord& c, double sin_rad, d
 void Pixels::rotate(double rad, const Coord& point)
 {
     // Right size, default to white (255 or 1111 1111)
-    std::vector<std::vector<unsigned char>> copy(h, std::vector<unsigned char>(w, 0xff));
+    BufferPool<unsigned char>& pool = BufferPool<unsigned char>::local();
+    std::vector<unsigned char> copy = pool.get(w*h, 0xff);
 
     // -rad because we're calculating the rotation to get from the new rotated
     // image to the original image. We're walking the new image instead of the
@@ -262,11 +386,16 @@ void Pixels::rotate(double rad, const Coord& point)
             const Coord c = rotatePoint(point, Coord(x,y), sin_rad, cos_rad);
 
             if (c != default_coord)
-                copy[y][x] = p[c.y][c.x];
+                copy[y*w + x] = img[c.y*w + c.x];
         }
     }
 
-    p = copy;
+    // Keep the old one around for the next rotation. If it was mapped,
+    // we're done with it.
+    p.swap(copy);
+    img = p.data();
+    pool.put(std::move(copy));
+    mapped.reset();
 
     // Rotate marks as well. This time we'll rotate to the new image, calculating the new
     // point instead of looking for what goes at every pixel in the new image.
@@ -8,8 +8,10 @@
 #define H_PIXELS
 
 #include <mutex>
+#include <memory>
 #include <vector>
 #include <string>
+#include <functional>
 #include <IL/il.h>
 
 #include "data.h"
@@ -24,16 +26,26 @@ struct Mark
         :coord(c), size(s) { }
 };
 
+// A decoded gray plane mapped from elsewhere, e.g. the shared memory a
+// decoder process wrote it to, along with how to unmap it
+typedef std::unique_ptr<const unsigned char,
+    std::function<void(const unsigned char*)>> MappedPlane;
+
 class Pixels
 {
     std::vector<Mark> marks;
-    std::vector<std::vector<unsigned char>> p;
+    std::vector<unsigned char> p;
+    MappedPlane mapped;
+    const unsigned char* img; // Row by row, w*h, either p or mapped
     int w;
     int h;
     bool loaded;
     std::string fn;
     unsigned char gray_shade;
 
+    // Only two shades, so the threshold is exact
+    bool two_shades;
+
     // Lock this so that only one thread can read an image or save()
     // OpenIL/DevIL is not multithreaded
     static std::mutex lock;
@@ -42,11 +54,34 @@ public:
     Pixels(); // Useful for placeholder
     Pixels(ILenum type, const char* lump, const int size, const std::string& fn = "");
 
+    // From an already decoded grayscale image, row by row
+    Pixels(int width, int height, std::vector<unsigned char>&& plane,
+        const std::string& fn = "");
+
+    // Using it where it's mapped rather than copying it. It's read only, so
+    // the first rotation copies it into a buffer of our own.
+    Pixels(int width, int height, MappedPlane&& plane,
+        const std::string& fn = "");
+
+    // Images are only ever moved from the decoder to the form, never copied.
+    // Moving or destroying gives the plane back to this thread's BufferPool.
+    Pixels(const Pixels&) = delete;
+    Pixels(Pixels&& other);
+    Pixels& operator=(const Pixels&) = delete;
+    Pixels& operator=(Pixels&& other);
+    ~Pixels();
+
     inline bool valid()  const { return loaded; }
     inline int  width()  const { return w; }
     inline int  height() const { return h; }
     inline const std::string& filename() const { return fn; }
 
+    // Whether it's exactly black and white, probably computer generated
+    inline bool bilevel() const { return two_shades; }
+
+    // The gray plane row by row, w*h, e.g. for sending it to another process
+    inline const unsigned char* plane() const { return img; }
+
     // This doesn't extend the image at all. If rotation and points
     // are determined correctly, it won't rotate out of the image.
     // Note: rad is angle of rotation in radians
@@ -78,6 +113,17 @@ public:
 
     // Was the image successfully loaded?
     bool isLoaded() const { return loaded; }
+
+    // A scaled down copy no larger than size in either dimension, averaging
+    // the pixels that get combined. Marks aren't copied.
+    Pixels thumbnail(int size = THUMBNAIL_SIZE) const;
+
+private:
+    // Threshold for black from the histogram
+    void findShade();
+
+    // Give the plane back to the pool
+    void recycle();
 };
 
 // Used so frequently and so small, so make this inline
@@ -85,7 +131,7 @@ inline bool Pixels::black(const Coord& c, const bool default_value) const
 {
     if (c.x >= 0 && c.y >= 0 &&
         c.x < w  && c.y < h)
-        return p[c.y][c.x] < gray_shade;
+        return img[c.y*w + c.x] < gray_shade;
 
     return default_value;
 }
@@ -0,0 +1,152 @@
+/*
+ * Recycle the large page-sized buffers (gray planes, labels, rotation copies)
+ * so that processing a page in steady state doesn't allocate or page fault.
+ * Each thread has its own pool, so there's no locking. A buffer may be
+ * returned on a different thread than it was taken on, which is fine since
+ * every worker both decodes and parses pages. With pinned workers, a
+ * thread's buffers are mostly on its NUMA node since that's where it first
+ * touched them.
+ *
+ * All the pools together keep at most poolLimit() bytes of free buffers. The
+ * Processor takes that out of its memory budget, so pooled buffers are
+ * accounted for without ever holding back a page waiting for memory.
+ *
+ * Example:
+ *
+ *   std::vector<int> labels = BufferPool<int>::local().get(w*h, 0);
+ *   // use it
+ *   BufferPool<int>::local().put(std::move(labels));
+ */
+
+#ifndef H_POOL
+#define H_POOL
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "options.h"
+
+// Most bytes of free buffers in all threads' pools together
+inline std::atomic<long long>& poolLimit()
+{
+    static std::atomic<long long> limit(POOL_BYTES);
+    return limit;
+}
+
+// Bytes of free buffers in all threads' pools now
+inline std::atomic<long long>& poolUsed()
+{
+    static std::atomic<long long> used(0);
+    return used;
+}
+
+template<class T> class BufferPool
+{
+public:
+    typedef typename std::vector<T>::size_type size_type;
+
+private:
+    std::vector<std::vector<T>> buffers;
+
+    // Capacity of our free buffers, our part of poolUsed()
+    long long bytes;
+
+public:
+    BufferPool() : bytes(0) { }
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool()
+    {
+        poolUsed() -= bytes;
+    }
+
+    // Get a buffer of this size filled with value, reusing the smallest free
+    // one that is large enough if we have one
+    std::vector<T> get(size_type size, const T& value);
+
+    // Give a buffer back. To stay under poolLimit(), our smallest are freed
+    // first, and if that's not enough, this one is.
+    void put(std::vector<T>&& buffer);
+
+    // This thread's pool
+    static BufferPool& local();
+
+private:
+    static long long capacityBytes(const std::vector<T>& buffer)
+    {
+        return static_cast<long long>(buffer.capacity())*sizeof(T);
+    }
+
+    // Take a free buffer out of the pool
+    std::vector<T> take(typename std::vector<std::vector<T>>::iterator buffer);
+};
+
+template<class T> std::vector<T> BufferPool<T>::take(
+        typename std::vector<std::vector<T>>::iterator buffer)
+{
+    std::vector<T> taken = std::move(*buffer);
+    buffers.erase(buffer);
+
+    const long long size = capacityBytes(taken);
+    bytes -= size;
+    poolUsed() -= size;
+
+    return taken;
+}
+
+template<class T> std::vector<T> BufferPool<T>::get(size_type size, const T& value)
+{
+    typedef typename std::vector<std::vector<T>>::iterator iterator;
+
+    iterator best = buffers.end();
+
+    for (iterator i = buffers.begin(); i != buffers.end(); ++i)
+        if (i->capacity() >= size &&
+            (best == buffers.end() || i->capacity() < best->capacity()))
+            best = i;
+
+    std::vector<T> buffer;
+
+    if (best != buffers.end())
+        buffer = take(best);
+
+    // If there's enough capacity, this doesn't reallocate
+    buffer.assign(size, value);
+
+    return buffer;
+}
+
+template<class T> void BufferPool<T>::put(std::vector<T>&& buffer)
+{
+    const long long size = capacityBytes(buffer);
+    const long long limit = poolLimit();
+
+    if (size == 0 || size > limit)
+        return;
+
+    // Make room, freeing our smallest first
+    while (!buffers.empty() && poolUsed() + size > limit)
+        take(std::min_element(buffers.begin(), buffers.end(),
+            [](const std::vector<T>& a, const std::vector<T>& b) {
+                return a.capacity() < b.capacity(); }));
+
+    // Other threads' pools have the rest, so free this one
+    if ((poolUsed() += size) > limit)
+    {
+        poolUsed() -= size;
+        return;
+    }
+
+    bytes += size;
+    buffers.push_back(std::move(buffer));
+}
+
+template<class T> BufferPool<T>& BufferPool<T>::local()
+{
+    static thread_local BufferPool<T> pool;
+    return pool;
+}
+
+#endif
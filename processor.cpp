@@ -1,35 +1,79 @@
+#include <cmath>
+#include <chrono>
 #include <cstdio>
 #include <vector>
 #include <cstring>
 #include <sstream>
 #include <iomanip>
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
+#include <sys/stat.h>
 #include <podofo/podofo.h>
 
 #include "box.h"
 #include "log.h"
+#include "arena.h"
 #include "math.h"
 #include "read.h"
 #include "data.h"
 #include "boxes.h"
+#include "classify.h"
 #include "rotate.h"
 #include "pixels.h"
+#include "pool.h"
+#include "spool.h"
+#include "sha256.h"
 #include "extract.h"
 #include "processor.h"
 
-Processor::Processor(int threads, bool website, Database& db)
-    : defaultForm(*this),
-      exiting(false),
+// How much of the memory limit, if there is one, the buffer pools may keep
+static long long poolShare(long long memoryLimit)
+{
+    if (memoryLimit <= 0)
+        return POOL_BYTES;
+
+    return std::min(POOL_BYTES, memoryLimit/POOL_SHARE);
+}
+
+Processor::Processor(int threads, bool website, Database& db, long long memoryLimit,
+        Retain retain, bool pin)
+    : exiting(false),
       waiting(false),
-      extractT(extractImages, threads),
-      parseT(parseImage, threads),
+      executor(threads, pin),
+      extractT(executor, extractImages, Priority::Normal),
+      memory(memoryLimit > 0 ? memoryLimit - poolShare(memoryLimit) : 0),
+      retain(retain),
+      journal(website?JOURNAL_DIR:""),
+      cache(website?CACHE_DB:""),
       db(db),
       website(website),
-      statusWaiting(0),
-      statusNewItem(false)
+      spool(nullptr),
+      pageMicros(static_cast<long long>(ADMIT_PAGE_SECONDS*1000000))
 {
+    poolLimit() = poolShare(memoryLimit);
+}
+
+// Guess how many pages a PDF or TIFF has from its size, for before we've
+// opened it. A PNG or JPEG is always one.
+static long long estimatePages(const std::string& filename)
+{
+    struct stat info;
+
+    if (stat(filename.c_str(), &info) != 0)
+        return 1;
+
+    char header[8];
+    std::ifstream file(filename, std::ios::binary);
+    file.read(header, sizeof(header));
+
+    const FileType type = fileType(header, file.gcount());
+
+    if (type == FileType::PNG || type == FileType::JPG)
+        return 1;
+
+    return std::max(1LL, static_cast<long long>(info.st_size)/ADMIT_PAGE_BYTES);
 }
 
 Processor::~Processor()
@@ -39,21 +83,87 @@ Processor::~Processor()
 
 void extractImages(Form* form)
 {
-    std::list<FormImage> newImages;
+    // Pages done before a restart are already counted as done. Images may
+    // be passed on from other threads decoding them.
+    std::atomic<long long> pages(form->resumed.size());
+    Processor& p = form->processor;
+
+    // Skip decoding images we already have the results for
+    CachedCallback cachedPage;
+
+    if (p.cache.enabled())
+        cachedPage = [form, &p, &pages](long long index, const std::string& hash) {
+            CachedPage page;
+
+            if (!p.cache.page(hash, page))
+                return false;
+
+            p.addCachedPage(*form, index, hash, page);
+            ++pages;
+            return true;
+        };
 
     try
     {
-        // Get the images from the PDF
-        newImages = extract(form->filename, *form);
+        // It may have been deleted while waiting to be extracted
+        p.checkCanceled(*form);
+
+        // If we've seen this exact PDF before, we may already have the
+        // results for every page
+        long long cached = -1;
 
-        // Set number of pages to however many images we got out of the PDF
-        form->pages = newImages.size();
+        if (p.cache.enabled() && form->resumed.empty())
+        {
+            form->hash = sha256File(form->filename);
+            cached = p.addCachedPdf(*form);
+        }
+
+        if (cached >= 0)
+        {
+            pages = cached;
+        }
+        else
+        {
+            // Get the images from the PDF, decoding several at once and
+            // queuing each one to be parsed as soon as it's decoded
+            extract(form->filename, *form,
+                [form, &p](long long width, long long height) {
+                    // Make sure there's room for decoding and then parsing
+                    // it, stopping here if canceled
+                    const long long bytes = planeBytes(width, height) +
+                        decodeBytes(width, height);
+                    p.reserve(*form, bytes, analysisBytes(width, height));
+                    return bytes;
+                },
+                [&p](long long reserved) {
+                    p.memory.release(reserved);
+                },
+                [form, &p, &pages](long long index, const std::string& hash,
+                        Pixels&& pixels, long long reserved) {
+                    // Done decoding, so now we just need the plane
+                    const long long bytes = planeBytes(pixels.width(), pixels.height());
+                    p.memory.release(reserved);
+                    p.memory.force(bytes);
+
+                    p.addImage(*form, std::move(pixels), bytes, index, hash);
+                    ++pages;
+                },
+                [&p](std::function<void()> task) {
+                    p.executor.queue(Priority::Normal, task);
+                },
+                cachedPage);
+        }
+    }
+    catch (const FormCanceled&)
+    {
+        // If we're exiting, leave it as is so we can resume it later.
+        // Otherwise, finish it below with however many pages were queued.
+        if (p.exiting)
+            return;
     }
     catch (const std::runtime_error& error)
     {
         form->log(form->filename + ", " + error.what());
-        form->processor.finish(form->id);
-        return;
     }
     catch (const PoDoFo::PdfError& error)
     {
@@ -62,30 +172,20 @@ void extractImages(Form* form)
 
         // Don't write this to screen
         form->log(form->filename + ", " + error.what(), LogType::Error);
-        form->processor.finish(form->id);
-        return;
     }
     catch (...)
     {
         form->log("Unhandled exception");
-        form->processor.finish(form->id);
-        return;
     }
 
-    // If no images, we're done
-    if (newImages.empty())
-        form->processor.finish(form->id);
-
-    // Add these extracted images to the queue after making sure there aren't
-    // any extraction errors
-    for (FormImage& i : newImages)
-        form->processor.parseT.queue(&i);
+    if (form->journal)
+        form->journal->pages(form->id, pages);
 
-    // Move these new images to the actual list. Do this here instead
-    // of directly appending them to the list so that we only need
-    // to lock this once.
-    std::unique_lock<std::mutex> lock(form->images_mutex);
-    form->formImages.splice(form->formImages.end(), newImages);
+    // Now we know how many pages there are, including if there was an error
+    // part way through. If they've all been parsed already (or there were
+    // none), we're done.
+    if (form->setPages(pages))
+        p.finish(form->id);
 }
 
 void parseImage(FormImage* formImage)
@@ -95,79 +195,130 @@ void parseImage(FormImage* formImage)
     static long long static_thread_id = 0;
     const long long thread_id = static_thread_id++;
 
+    // Labels, rotating, etc. Don't block here since finishing this page is
+    // what frees up memory.
+    Processor& p = formImage->form.processor;
+    MemoryBudget& memory = p.memory;
+    const long long analysis = analysisBytes(formImage->image.width(),
+            formImage->image.height());
+    memory.force(analysis);
+
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+    // Whether we stopped part way through
+    bool canceled = false;
+
     // When this thread has an error, write message including thread id, but
     // continue processing the rest of the images.
     try
     {
-        // Find all blobs in the image
-        Blobs blobs(formImage->image);
+        // Outlines, bubbles, etc. come from this thread's arena, all freed
+        // at once when we're done with this page. Declared first so it's
+        // reset after everything using it is destroyed.
+        ArenaScope arena;
 
-        // Box information for this image
-        Data data;
+        // Skip it entirely if it was queued before being canceled
+        p.checkCanceled(formImage->form);
 
-        // Find all the boxes
-        std::vector<Coord> boxes = findBoxes(formImage->image, blobs, data);
+        // Don't spend time labeling blank pages, cover sheets, etc.
+        std::string reason;
 
-        if (boxes.size() > TOTAL_BOXES)
-            throw std::runtime_error("too many boxes detected");
+        if (classifyPage(formImage->image, reason) != PageKind::Form)
+            throw std::runtime_error("page " +
+                    std::to_string(formImage->index + 1) + " skipped, " + reason);
 
-        if (boxes.size() < TOTAL_BOXES)
-            throw std::runtime_error("some boxes not detected");
+        // Computer-generated pages can be read right where the bubbles are
+        // without labeling or rotating. Otherwise, do it the usual way.
+        Data data;
+        std::vector<Coord> boxes;
+        long long id = DefaultID;
+        std::vector<Answer> answers;
 
-        if (DEBUG)
+        if (formImage->image.bilevel())
+            boxes = findAlignedBoxes(formImage->image, data);
+
+        if (boxes.empty() || !readAligned(formImage->image, boxes, data, id, answers))
         {
-            std::ostringstream s_orig;
-            s_orig << "debug" << thread_id << "_orig.png";
-            formImage->image.save(s_orig.str(), true, false, true);
-        }
+            // Find all blobs in the image
+            Blobs blobs(formImage->image);
+            p.checkCanceled(formImage->form);
 
-        // Rotate the image
-        Coord rotate_point;
-        double rotation = findRotation(formImage->image, boxes, rotate_point);
+            // Find all the boxes
+            boxes = findBoxes(formImage->image, blobs, data);
 
-        // Negative since the origin is the top-left point (this is the 4th quadrant)
-        if (rotation != 0)
-        {
-            formImage->image.rotate(-rotation, rotate_point);
-            formImage->image.rotateVector(boxes, rotate_point, -rotation);
+            if (boxes.size() > TOTAL_BOXES)
+                throw std::runtime_error("too many boxes detected");
 
-            // The blobs are constant, so just recalculate them all
-            blobs = Blobs(formImage->image);
-        }
+            if (boxes.size() < TOTAL_BOXES)
+                throw std::runtime_error("some boxes not detected");
 
-        // Sort all boxes with respect to y if we rotated counter-clockwise
-        if (rotation > 0)
-            std::sort(boxes.begin(), boxes.end());
+            p.checkCanceled(formImage->form);
 
-        // Sort the bottom row of boxes by increasing x coordinates.
-        std::sort(boxes.begin()+BOT_START-1, boxes.begin()+BOT_END, CoordXSort());
+            if (DEBUG)
+            {
+                std::ostringstream s_orig;
+                s_orig << "debug" << thread_id << "_orig.png";
+                formImage->image.save(s_orig.str(), true, false, true);
+            }
 
-        // Determine what is black (changes in BW, color, and grayscale)
-        double black = findBlack(formImage->image, blobs, boxes, data);
+            // Rotate the image
+            Coord rotate_point;
+            double rotation = findRotation(formImage->image, boxes, rotate_point);
 
-        // Find ID number
-        long long id = findID(formImage->image, blobs, boxes, data, black);
+            // Negative since the origin is the top-left point (this is the 4th quadrant)
+            if (rotation != 0)
+            {
+                formImage->image.rotate(-rotation, rotate_point);
+                formImage->image.rotateVector(boxes, rotate_point, -rotation);
 
-        std::vector<Answer> answers;
+                // The blobs are constant, so just recalculate them all
+                blobs = Blobs(formImage->image);
+            }
 
-        // Don't bother finding answers if we couldn't even get the student ID
-        if (id != DefaultID)
-            answers = findAnswers(formImage->image, blobs, boxes, data, black);
+            p.checkCanceled(formImage->form);
 
-        // Debug information
-        if (DEBUG)
-        {
-            for (const Coord& box : boxes)
-                formImage->image.mark(box);
+            // Sort all boxes with respect to y if we rotated counter-clockwise
+            if (rotation > 0)
+                std::sort(boxes.begin(), boxes.end());
 
-            std::ostringstream s;
-            s << "debug" << thread_id << ".png";
-            formImage->image.save(s.str());
+            // Sort the bottom row of boxes by increasing x coordinates.
+            std::sort(boxes.begin()+BOT_START-1, boxes.begin()+BOT_END, CoordXSort());
+
+            // Determine what is black (changes in BW, color, and grayscale)
+            double black = findBlack(formImage->image, blobs, boxes, data);
+
+            // Find ID number
+            id = findID(formImage->image, blobs, boxes, data, black);
+            p.checkCanceled(formImage->form);
+
+            // Don't bother finding answers if we couldn't even get the student ID
+            if (id != DefaultID)
+                answers = findAnswers(formImage->image, blobs, boxes, data, black);
+
+            // Debug information
+            if (DEBUG)
+            {
+                for (const Coord& box : boxes)
+                    formImage->image.mark(box);
+
+                std::ostringstream s;
+                s << "debug" << thread_id << ".png";
+                formImage->image.save(s.str());
+            }
         }
 
         formImage->id = id;
         formImage->answers = answers;
         formImage->thread_id = thread_id;
+
+        // Remember the results in case we see this same page again
+        if (id != DefaultID && !formImage->hash.empty())
+            p.cache.addPage(formImage->hash, id, answers);
+    }
+    catch (const FormCanceled&)
+    {
+        canceled = true;
     }
     catch (const std::runtime_error& error)
     {
@@ -179,35 +330,80 @@ void parseImage(FormImage* formImage)
         }
 
         std::ostringstream msg;
-        if (!formImage->form.processor.website)
+        if (!p.website)
             msg << "thread #" << thread_id << ", " << formImage->image.filename() << " - ";
         msg << error.what();
         formImage->form.log(msg.str());
     }
 
-    // Another page is complete
-    formImage->form.incDone();
+    if (canceled)
+    {
+        // Nobody wants the results, so free the image. The memory is
+        // released below along with that of the other pages.
+        formImage->image = Pixels();
 
-    // If we're in website mode, add this form update to the queue so that
-    // connections can send another update if waiting on this form
-    if (formImage->form.processor.website)
+        // If we're exiting, leave the form as is so we can resume it later
+        if (p.exiting)
+        {
+            memory.release(analysis + formImage->reserved);
+            formImage->reserved = 0;
+            return;
+        }
+    }
+    else
     {
-        // Get how close this form is to being done
-        int percentage = smartFloor(
-                100.0*formImage->form.getDone()/formImage->form.pages);
+        p.pageTimed(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count());
 
-        // Return 99 if it's "done," the last percent is adding it to
-        // the database, etc.
-        if (percentage == 100)
-            percentage = 99;
+        // Save the results so we don't have to redo this page if restarted
+        if (formImage->form.journal)
+            formImage->form.journal->page(formImage->form.id, formImage->index,
+                    formImage->id, formImage->answers);
+    }
 
-        formImage->form.processor.statusAdd(
-                Status(formImage->form.id, percentage));
+    // We only need the results now, so free the image unless we want to
+    // keep it around for review
+    switch (p.retain)
+    {
+        case Retain::Results:
+            formImage->image = Pixels();
+            break;
+        case Retain::Thumbnail:
+            formImage->image = formImage->image.thumbnail();
+            break;
+        case Retain::Image:
+            break;
     }
 
-    // If done, save results
-    if (formImage->form.getDone() == formImage->form.pages)
-        formImage->form.processor.finish(formImage->form.id);
+    // This page isn't in flight anymore. If we're keeping the image, it stays
+    // in the form until it's finished, but we won't be allocating anything
+    // else for it.
+    memory.release(analysis + formImage->reserved);
+    formImage->reserved = 0;
+
+    // Once this page counts as done, another page or the extraction may
+    // finish the form and delete it, so get what we need from it first
+    Form& form = formImage->form;
+    const long long formId = form.id;
+
+    // How close this form will be to being done. Return 99 if it's "done,"
+    // the last percent is adding it to the database, etc.
+    int percentage = smartFloor(100.0*form.progress(1));
+
+    if (percentage == 100)
+        percentage = 99;
+
+    // Another page is complete
+    const bool last = form.incDone();
+
+    // If we're in website mode, add this form update to the queue so that
+    // connections can send another update if waiting on this form
+    if (p.website)
+        p.statusAdd(Status(formId, percentage));
+
+    // If done, save results, or if canceled, clean up
+    if (last)
+        p.finish(formId);
 }
 
 void Processor::wait()
@@ -216,10 +412,7 @@ void Processor::wait()
 
     // Just in case somebody tries wait() after exit()
     if (!exiting)
-    {
-        extractT.wait();
-        parseT.wait();
-    }
+        executor.wait();
 }
 
 void Processor::exit()
@@ -230,89 +423,165 @@ void Processor::exit()
 
     // Tell all waiting threads to exit
     exiting = true;
-    statusWakeAll();
+
+    if (collector.joinable())
+        collector.join();
 
     // Only exit these threads if we haven't already waited for them to complete
     // (thus they already exited)
     if (!waiting)
-    {
-        extractT.exit();
-        parseT.exit();
-    }
+        executor.exit();
+}
+
+bool Processor::done(long long id)
+{
+    return forms.find(id) == nullptr;
 }
 
-Form& Processor::findForm(long long id)
+bool Processor::cancel(long long id)
 {
-    std::unique_lock<std::mutex> lock(forms_mutex);
-    std::list<Form>::iterator i = std::find_if(forms.begin(), forms.end(),
-            FormPredicate(id));
+    if (!forms.visit(id, [](Form& form) { form.canceled = true; }))
+        return false;
 
-    if (i == forms.end())
-        return defaultForm;
-    else
-        return *i;
+    // If no worker has it yet, it's done
+    if (spool && spool->withdraw(id))
+        finishSpooled(id, "", "");
+
+    return true;
 }
 
-bool Processor::done(long long id)
+void Processor::checkCanceled(const Form& form) const
 {
-    Form& form = findForm(id);
-    return form == defaultForm;
+    if (form.canceled || exiting)
+        throw FormCanceled();
+}
+
+void Processor::onFinish(FinishCallback callback)
+{
+    finished = callback;
 }
 
 void Processor::finish(long long id)
 {
-    // Only do this when used with the website. We don't want to delete
-    // forms passed in as command line arguments.
-    if (!website)
+    // Only do this when used with the website or if the results are being
+    // written as each form is done. Otherwise, we keep forms passed in as
+    // command line arguments till they're printed after wait().
+    if (!website && !finished)
         return;
 
     std::string summary;
     std::string exported;
     std::string filename;
+    bool canceled;
 
     {
-        std::unique_lock<std::mutex> lock(forms_mutex);
-        std::list<Form>::iterator form = std::find_if(forms.begin(), forms.end(),
-                FormPredicate(id));
+        std::unique_ptr<Form> form = forms.remove(id);
 
         // Not found
-        if (form == forms.end())
+        if (!form)
             return;
 
-        // Get output
-        summary = print(*form);
-        exported = csv(*form);
         filename = form->filename;
+        canceled = form->canceled;
+
+        // Pages done before a restart are at the front, so put them back in
+        // the order they are in the PDF
+        form->formImages.sort([](const FormImage& a, const FormImage& b) {
+                return a.index < b.index; });
+
+        if (!website)
+        {
+            finished(*form);
+            return;
+        }
+
+        // If we see this PDF again, we can look up all the pages
+        if (!canceled && cache.enabled() && !form->hash.empty())
+        {
+            std::vector<std::string> hashes;
+
+            for (const FormImage& image : form->formImages)
+                if (!image.hash.empty())
+                    hashes.push_back(image.hash);
+
+            // It's only a cache, so if we can't write to it, just say so
+            try
+            {
+                if (hashes.size() == form->formImages.size())
+                    cache.addPdf(form->hash, hashes);
+            }
+            catch (const std::runtime_error& error)
+            {
+                log("couldn't cache " + form->filename + ", " + error.what(),
+                    LogType::Warning);
+            }
+        }
+
+        // Get output
+        if (!canceled)
+        {
+            summary = print(*form);
+            exported = csv(*form);
+        }
+    }
 
-        // Delete from list
-        forms.erase(form);
+    save(id, filename, canceled, summary, exported);
+}
+
+void Processor::finishSpooled(long long id, const std::string& summary,
+    const std::string& exported)
+{
+    std::string filename;
+    bool canceled;
+
+    {
+        std::unique_ptr<Form> form = forms.remove(id);
+
+        // Not found, e.g. collected twice
+        if (!form)
+            return;
+
+        filename = form->filename;
+        canceled = form->canceled;
     }
 
-    // Save to database
-    db.updateForm(id, summary, exported);
+    save(id, filename, canceled, summary, exported);
+}
+
+void Processor::save(long long id, const std::string& filename, bool canceled,
+    const std::string& summary, const std::string& exported)
+{
+    // Save to database, unless it was deleted
+    if (!canceled)
+        db.updateForm(id, summary, exported);
 
     // We're done, send final update
     statusAdd(Status(id, 100));
 
     // Delete off disk last, if we get killed right before doing this,
-    // we'll see this file still exists and reprocess this form on start
+    // we'll see this file still exists and resume this form on start
     if (std::remove(filename.c_str()) != 0)
         log("Couldn't delete form \"" + filename + "\"");
+
+    // If we got killed before this, we'd resume the form, see that all the
+    // pages are done, and just save the results again
+    journal.remove(id);
 }
 
 std::string Processor::print(long long id)
 {
-    Form& form = findForm(id);
-    return print(form);
+    Form* form = forms.find(id);
+
+    if (!form)
+        return "";
+
+    return print(*form);
 }
 
 std::string Processor::print(Form& form)
 {
     std::ostringstream out;
 
-    if (form == defaultForm)
-        return "";
-
     // Find the key based on the key's ID
     out << std::left;
 
@@ -426,17 +695,18 @@ std::string Processor::print(Form& form)
 
 std::string Processor::csv(long long id)
 {
-    Form& form = findForm(id);
-    return csv(form);
+    Form* form = forms.find(id);
+
+    if (!form)
+        return "";
+
+    return csv(*form);
 }
 
 std::string Processor::csv(Form& form)
 {
     std::ostringstream out;
 
-    if (form == defaultForm)
-        return "";
-
     // Print header
     out << "ID, Score";
 
@@ -524,55 +794,262 @@ std::string Processor::csv(Form& form)
     return out.str();
 }
 
-void Processor::add(long long id, long long key, const std::string& filename)
+void Processor::add(long long id, long long key, const std::string& filename,
+        bool deferred)
+{
+    std::unique_ptr<Form> created(new Form(id, key, filename, *this));
+    created->expected = estimatePages(filename);
+
+    if (journal.enabled())
+    {
+        journal.add(id, key, filename);
+        created->journal = &journal;
+    }
+
+    Form* form = forms.add(std::move(created));
+
+    // Let a worker do it. If we can't, do it here.
+    if (spool)
+    {
+        if (spool->submit(id, key, filename))
+            return;
+
+        log("couldn't add form " + std::to_string(id) + " to spool, processing it here");
+    }
+
+    // Decoding the pages of forms that aren't deferred comes first
+    if (deferred)
+        executor.queue(Priority::Low, [form]() { extractImages(form); });
+    else
+        extractT.queue(form);
+}
+
+Admission Processor::admit(long long bytes, int& retryAfter)
 {
-    std::unique_lock<std::mutex> lock(forms_mutex);
-    forms.push_back(Form(id, key, filename, *this));
-    extractT.queue(&forms.back());
+    const long long pages = backlog() + std::max(1LL, bytes/ADMIT_PAGE_BYTES);
+    retryAfter = 0;
+
+    if (pages > ADMIT_DEFER_PAGES)
+    {
+        // About how long till we've parsed enough to fit this one
+        const double seconds = 1e-6*pageMicros*(pages - ADMIT_DEFER_PAGES)/
+            std::max(1, executor.threads());
+        retryAfter = std::min(ADMIT_RETRY_MAX, std::max(ADMIT_RETRY_MIN,
+                    static_cast<int>(std::ceil(seconds))));
+
+        return Admission::Busy;
+    }
+
+    // If we're out of memory, anything else we decode will just be waiting
+    if (pages > ADMIT_PAGES || (memory.max() > 0 && memory.usage() >= memory.max()))
+        return Admission::Defer;
+
+    return Admission::Accept;
+}
+
+long long Processor::backlog()
+{
+    long long total = 0;
+
+    forms.visitAll([&total](Form& form) {
+        const long long done = form.getDone();
+        long long pages = form.getPages();
+
+        if (pages < 0)
+            pages = std::max(form.expected.load(), done+1);
+
+        total += std::max(0LL, pages - done);
+    });
+
+    return total;
 }
 
-std::vector<Status> Processor::statusWait()
+void Processor::pageTimed(long long micros)
 {
-    std::unique_lock<std::mutex> lck(status_mutex);
-    ++statusWaiting;
+    // Exponential moving average. Racing updates may lose one, which is fine
+    // for an estimate.
+    const long long average = pageMicros;
+    pageMicros = average + (micros - average)/8;
+}
 
-    while (true)
+void Processor::resume()
+{
+    for (const JournalForm& f : journal.recover())
     {
-        statusCond.wait(lck, [this] { return statusNewItem || exiting; });
+        // If the PDF is gone, we finished it but got killed before deleting
+        // the journal
+        struct stat info;
 
-        if (statusNewItem || exiting)
-            break;
+        if (stat(f.filename.c_str(), &info) != 0)
+        {
+            journal.remove(f.id);
+            continue;
+        }
+
+        std::unique_ptr<Form> created(new Form(f.id, f.key, f.filename, *this));
+        created->expected = (f.pages >= 0)?f.pages:estimatePages(f.filename);
+        created->journal = &journal;
+        created->output = f.output;
+
+        for (const JournalPage& page : f.done)
+        {
+            // Only count each page once
+            if (!created->resumed.insert(page.index).second)
+                continue;
+
+            created->formImages.emplace_back(*created, Pixels(), 0, page.index);
+            created->formImages.back().id = page.id;
+            created->formImages.back().answers = page.answers;
+        }
+
+        created->setDone(created->resumed.size());
+
+        Form* form = forms.add(std::move(created));
+        log("resuming form " + std::to_string(f.id) + " with " +
+                std::to_string(form->getDone()) + " pages done", LogType::Notice);
+
+        // If we knew how many pages there were and they're all done, we just
+        // need to save the results. Otherwise, decode the rest.
+        if (f.pages >= 0 && f.pages == form->getDone())
+        {
+            if (form->setPages(f.pages))
+                finish(f.id);
+        }
+        else if (!spool || !spool->submit(f.id, f.key, f.filename))
+        {
+            extractT.queue(form);
+        }
     }
+}
 
-    --statusWaiting;
+void Processor::useSpool(Spool& s)
+{
+    spool = &s;
+    collector = std::thread(&Processor::collect, this);
+}
+
+void Processor::collect()
+{
+    while (!exiting)
+    {
+        spool->collect([this](long long id, const std::string& summary,
+                    const std::string& exported) {
+            finishSpooled(id, summary, exported);
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(SPOOL_POLL_MS));
+    }
+}
 
-    // Copy it so we can return this even if we clear it below
-    std::vector<Status> results = status;
+void Processor::addImage(Form& form, Pixels&& pixels, long long reserved,
+        long long index, const std::string& hash)
+{
+    FormImage* image;
+    bool first;
 
-    // Everybody waiting grabbed the status updates already
-    if (statusWaiting == 0)
+    // The list gives us a consistent address to queue
     {
-        status.clear();
-        statusNewItem = false;
+        std::unique_lock<std::mutex> lock(form.images_mutex);
+        form.formImages.emplace_back(form, std::move(pixels), reserved, index);
+        image = &form.formImages.back();
+        image->hash = hash;
+        first = form.formImages.size() == 1;
     }
 
-    return results;
+    // Small forms get more turns so they finish soon even if a large one is
+    // being processed. The first page of each form goes ahead of everything
+    // so each form starts showing progress right away, and it's often the key.
+    const long long expected = form.expected;
+    const int weight = (expected > 0 && expected <= SMALL_FORM_PAGES)?
+        SMALL_FORM_WEIGHT:1;
+
+    parseQueue.push(form.id, image, weight, first);
+
+    // One task per page, so there's always a task for every page queued
+    executor.queue(Priority::High, [this]() { parseNext(); });
 }
 
-void Processor::statusAdd(const Status& newStatus)
+void Processor::parseNext()
+{
+    FormImage* image;
+
+    if (parseQueue.pop(image))
+        parseImage(image);
+}
+
+void Processor::addCachedPage(Form& form, long long index,
+        const std::string& hash, const CachedPage& page)
+{
+    std::unique_lock<std::mutex> lock(form.images_mutex);
+    form.formImages.emplace_back(form, Pixels(), 0, index);
+
+    FormImage& image = form.formImages.back();
+    image.hash = hash;
+    image.id = page.id;
+    image.answers = page.answers;
+
+    // This won't be the last page since we're still extracting, so we don't
+    // have to check if we're done
+    form.incDone();
+}
+
+long long Processor::addCachedPdf(Form& form)
+{
+    std::vector<std::string> hashes;
+
+    if (!cache.pdf(form.hash, hashes))
+        return -1;
+
+    // Only use it if we have all of them, otherwise we'd have to decode
+    // the PDF anyway
+    std::vector<CachedPage> results(hashes.size());
+
+    for (std::vector<std::string>::size_type i = 0; i < hashes.size(); ++i)
+        if (!cache.page(hashes[i], results[i]))
+            return -1;
+
+    for (std::vector<std::string>::size_type i = 0; i < hashes.size(); ++i)
+        addCachedPage(form, i, hashes[i], results[i]);
+
+    return hashes.size();
+}
+
+void Processor::reserve(const Form& form, long long bytes, long long headroom)
 {
+    checkCanceled(form);
+
+    while (!memory.tryReserve(bytes, headroom))
     {
-        std::unique_lock<std::mutex> lock(status_mutex);
-        status.push_back(std::move(newStatus));
-        statusNewItem = true;
+        checkCanceled(form);
+
+        // Rather than holding up a thread, parse a page if there's one
+        if (!executor.help(Priority::High))
+            memory.waitForRelease(std::chrono::milliseconds(10));
     }
+}
+
+long long Processor::memoryUsage()
+{
+    return memory.usage();
+}
+
+long long Processor::memoryLimit() const
+{
+    return memory.max();
+}
 
-    statusCond.notify_all();
+long long Processor::statusSubscribe(long long formId,
+        const StatusCallback& callback)
+{
+    return status.subscribe(formId, callback);
 }
 
-void Processor::statusWakeAll()
+bool Processor::statusUnsubscribe(long long formId, long long subscription)
+{
+    return status.unsubscribe(formId, subscription);
+}
+
+void Processor::statusAdd(const Status& newStatus)
 {
-    std::unique_lock<std::mutex> lck(status_mutex);
-    statusNewItem = true;
-    statusCond.notify_all();
+    status.publish(newStatus);
 }
@@ -5,52 +5,77 @@
 #ifndef H_PROCESSOR
 #define H_PROCESSOR
 
-#include <list>
 #include <mutex>
 #include <atomic>
 #include <string>
-#include <condition_variable>
+#include <thread>
+#include <functional>
 
 #include "forms.h"
-#include "threadqueuevoid.h"
+#include "cache.h"
+#include "memory.h"
+#include "statuschannels.h"
+#include "journal.h"
+#include "executor.h"
+#include "fairqueue.h"
+#include "formregistry.h"
 #include "website/database.h"
 
+class Spool;
+
 // Called in a new thread for each new form
 void extractImages(Form* form);
 
 // Called in a new thread for each image
 void parseImage(FormImage* formImage);
 
-// For sending status updates
-struct Status
-{
-    long long formId;
-    int percentage;
+// Thrown between the steps of processing a form once it's canceled or we're
+// exiting so we stop as soon as possible
+class FormCanceled { };
 
-    Status(long long formId, int percentage)
-        : formId(formId), percentage(percentage)
-    {
-    }
+// Whether to take on a new form: process it as usual, accept it but only
+// process it once nothing else is waiting, or refuse it for now
+enum class Admission
+{
+    Accept, Defer, Busy
 };
 
+// Called with each form once it's done when not running the website
+typedef std::function<void(Form&)> FinishCallback;
+
 // Main class to manage processing the forms
 class Processor
 {
-    // Compare with this to see if we successfully found a form
-    Form defaultForm;
-
     // Set if we want to wait or exit
     std::atomic_bool exiting;
     std::atomic_bool waiting;
 
     // We need consistent memory locations since we're adding the address to a
     // queue to process as we load each image and form.
-    std::list<Form> forms;
-    std::mutex forms_mutex;
+    FormRegistry forms;
+
+    // One pool of threads shared by extracting and parsing. Parsing has
+    // priority so that we finish the pages we have before decoding more.
+    Executor executor;
+    ExecutorStage<Form*> extractT;
+
+    // Decoded pages waiting to be parsed. Each parse task takes the next page
+    // from here, taking turns between forms rather than in the order they
+    // were decoded.
+    FairQueue<FormImage*> parseQueue;
+
+    // Limit how many pages we decode at once
+    MemoryBudget memory;
 
-    // The threads
-    ThreadQueueVoid<Form*> extractT;
-    ThreadQueueVoid<FormImage*> parseT;
+    // What we keep of the page images after parsing them
+    Retain retain;
+
+    // Progress saved to disk so we can resume after a restart, only used
+    // with the website
+    Journal journal;
+
+    // Results of PDFs and pages we've seen before, only used with the website
+    Cache cache;
 
     // We need to add the new forms to this database
     Database& db;
@@ -59,23 +84,61 @@ class Processor
     // We do on the site, not for CLI usage
     bool website;
 
+    // If set, when not running the website, give each form to this when done
+    // and then delete it rather than keeping it till wait() returns
+    FinishCallback finished;
+
+    // If set, with the website, forms are processed by worker processes
+    // rather than here, and this thread saves their results
+    Spool* spool;
+    std::thread collector;
+
     // Updated whenever an image is done being processed
-    std::mutex status_mutex;
-    int statusWaiting;
-    bool statusNewItem;
-    std::vector<Status> status;
-    std::condition_variable statusCond;
+    StatusChannels status;
+
+    // Moving average of how long parsing a page takes in microseconds, for
+    // estimating how long it'll take to get through what's queued
+    std::atomic<long long> pageMicros;
 
 public:
-    Processor(int threads, bool website, Database& db);
+    // Memory limit in bytes for pages being processed, 0 for no limit. If pin,
+    // each thread stays on one CPU.
+    Processor(int threads, bool website, Database& db, long long memoryLimit = 0,
+        Retain retain = Retain::Results, bool pin = false);
     ~Processor();
 
-    // Add a new form to be processed
-    void add(long long id, long long key, const std::string& filename);
+    // Add a new form to be processed. If deferred, it's only decoded when
+    // there's nothing else waiting to be decoded.
+    void add(long long id, long long key, const std::string& filename,
+        bool deferred = false);
+
+    // Whether to take on a new PDF of this size given how many pages are
+    // waiting to be parsed and how much memory is in use. If Busy, sets
+    // retryAfter to about how many seconds till there'll be room.
+    Admission admit(long long bytes, int& retryAfter);
+
+    // Write out each form as soon as it's done rather than after wait(). Set
+    // before adding any forms.
+    void onFinish(FinishCallback callback);
+
+    // Continue processing the forms we were working on when we were last
+    // stopped, skipping the pages that were already done
+    void resume();
+
+    // With the website, give forms to workers through this spool rather than
+    // processing them here, and start saving the results they write back
+    // till exit(). Set before adding or resuming any forms.
+    void useSpool(Spool& spool);
 
     // Return if it's done yet (i.e., the form no longer exists)
     bool done(long long id);
 
+    // Stop processing a form, e.g. when it's deleted. Pages not yet parsed are
+    // skipped, pages being parsed stop at the next step, and the form is
+    // cleaned up without saving results. Returns false if it wasn't being
+    // processed.
+    bool cancel(long long id);
+
     // Get the results and delete the form (only for use with daemon)
     std::string get(long long id);
 
@@ -93,23 +156,63 @@ public:
     // Exit all threads
     void exit();
 
-    // Block until more forms have been processed returning all of the status
-    // updates, which may include previous ones if another form finished being
-    // processed before all the previous status updates were grabbed
-    std::vector<Status> statusWait();
+    // Get the next status update for this form, or the latest one if there
+    // was one since the last time somebody asked. Returns an ID to use to
+    // unsubscribe. See StatusChannels.
+    long long statusSubscribe(long long formId, const StatusCallback& callback);
+    bool statusUnsubscribe(long long formId, long long subscription);
 
-    // Fake that there is a new status item, e.g. use it to wake up all blocked
-    // statusWait() calls so that you can restart the website
-    void statusWakeAll();
+    // Approximate memory used by pages being processed and the limit
+    long long memoryUsage();
+    long long memoryLimit() const;
 
 private:
-    // Get reference to either the form with this ID or the defaultForm
-    // if this ID doesn't exist
-    Form& findForm(long long id);
-
     // Finish processing the form, add it to the database, delete the PDF
     void finish(long long id);
 
+    // Save the results of forms the workers finished till we're exiting
+    void collect();
+
+    // Finish a form a worker processed or that was withdrawn from the spool
+    void finishSpooled(long long id, const std::string& summary,
+        const std::string& exported);
+
+    // Add the results to the database unless canceled, send the final status
+    // update, and delete the PDF and the form's journal
+    void save(long long id, const std::string& filename, bool canceled,
+        const std::string& summary, const std::string& exported);
+
+    // Parse the next page from the parse queue
+    void parseNext();
+
+    // Pages in all the forms not parsed yet, estimated from the size of the
+    // PDF if we haven't looked at it yet
+    long long backlog();
+
+    // Update the average time per page
+    void pageTimed(long long micros);
+
+    // Add a newly decoded page to the form and queue it to be parsed
+    void addImage(Form& form, Pixels&& pixels, long long reserved,
+        long long index, const std::string& hash);
+
+    // Add a page we already have the results for from the cache
+    void addCachedPage(Form& form, long long index, const std::string& hash,
+        const CachedPage& page);
+
+    // If we have the results for all the pages of this PDF in the cache, add
+    // them and return how many there are, otherwise return -1
+    long long addCachedPdf(Form& form);
+
+    // Reserve memory leaving room for headroom more, blocking till there's
+    // enough. Meanwhile, parse pages that are already decoded since that's
+    // what frees memory. Throws FormCanceled if the form is canceled or we're
+    // exiting.
+    void reserve(const Form& form, long long bytes, long long headroom);
+
+    // Throw FormCanceled if we should stop processing this form
+    void checkCanceled(const Form& form) const;
+
     // Needs to accses mutexes and image list
     friend void extractImages(Form*);
 
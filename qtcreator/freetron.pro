@@ -4,16 +4,31 @@ CONFIG -= app_bundle
 CONFIG -= qt
 
 SOURCES += \
+    ../owner.cpp \
+    ../sha256.cpp \
+    ../classify.cpp \
+    ../spool.cpp \
+    ../watch.cpp \
+    ../mappedfile.cpp \
+    ../decoders.cpp \
+    ../statuschannels.cpp \
+    ../cache.cpp \
+    ../batch.cpp \
+    ../journal.cpp \
+    ../formregistry.cpp \
+    ../arena.cpp \
     ../rotate.cpp \
     ../read.cpp \
     ../pixels.cpp \
     ../outline.cpp \
     ../math.cpp \
+    ../memory.cpp \
     ../log.cpp \
     ../histogram.cpp \
     ../freetron.cpp \
     ../extract.cpp \
     ../data.cpp \
+    ../executor.cpp \
     ../cores.cpp \
     ../boxes.cpp \
     ../box.cpp \
@@ -27,13 +42,28 @@ SOURCES += \
     ../website/website.cpp
 
 HEADERS += \
-    ../threadqueue.h \
+    ../owner.h \
+    ../sha256.h \
+    ../classify.h \
+    ../spool.h \
+    ../watch.h \
+    ../mappedfile.h \
+    ../decoders.h \
+    ../fairqueue.h \
+    ../statuschannels.h \
+    ../cache.h \
+    ../batch.h \
+    ../journal.h \
+    ../formregistry.h \
+    ../arena.h \
     ../rotate.h \
     ../read.h \
     ../pixels.h \
+    ../pool.h \
     ../outline.h \
     ../options.h \
     ../math.h \
+    ../memory.h \
     ../maputils.h \
     ../log.h \
     ../histogram.h \
@@ -43,7 +73,8 @@ HEADERS += \
     ../boxes.h \
     ../box.h \
     ../blobs.h \
-    ../threadqueuevoid.h \
+    ../executor.h \
+    ../workdeque.h \
     ../forms.h \
     ../processor.h \
     ../website/content.h \
@@ -1,6 +1,7 @@
 #include <map>
 #include <cmath>
 #include <string>
+#include <algorithm>
 
 #include "log.h"
 #include "box.h"
@@ -98,7 +99,7 @@ long long findID(Pixels& img, const Blobs& blobs,
     {
         // Get bubbles in this column of the number
         const int center = boxes[BOT_START].x + jump*i;
-        const std::vector<Bubble> bubbles = findBubbles(img, blobs, data.diag,
+        const ArenaVector<Bubble> bubbles = findBubbles(img, blobs, data.diag,
              Coord(center - half_jump, y_start),
              Coord(center + half_jump, y_end));
         const int radius = avgRadius(bubbles);
@@ -122,6 +123,32 @@ long long findID(Pixels& img, const Blobs& blobs,
     return id;
 }
 
+// Where the bubbles of this column of questions start and end along x. These
+// are all relative to the bottom boxes. This would be different for every type
+// of form, but for all from this manufacturer they are the same. (Or so their
+// website seems to indicate.) Returns false if there's no such column.
+static bool answerColumn(const std::vector<Coord>& boxes, const double jump,
+    const int column, int& start, int& end)
+{
+    switch (column)
+    {
+        case 0:
+            start = boxes[BOT_START].x;
+            end   = boxes[BOT_START+2].x;
+            return true;
+        case 1:
+            start = boxes[BOT_START+3].x - jump;
+            end   = boxes[BOT_START+4].x + jump;
+            return true;
+        case 2:
+            start = boxes[BOT_START+5].x;
+            end   = boxes[BOT_START+7].x;
+            return true;
+        default:
+            return false;
+    }
+}
+
 std::vector<Answer> findAnswers(Pixels& img, const Blobs& blobs,
     const std::vector<Coord>& boxes, const Data& data, const double min_black)
 {
@@ -143,31 +170,12 @@ std::vector<Answer> findAnswers(Pixels& img, const Blobs& blobs,
         int start = 0;
         int end   = 0;
 
-        // These are all relative to the bottom boxes. This would be different for every
-        // type of form, but for all from this manufacturer they are the same. (Or so their
-        // website seems to indicate.)
-        switch (column)
-        {
-            case 0:
-                start = boxes[BOT_START].x;
-                end   = boxes[BOT_START+2].x;
-                break;
-            case 1:
-                start = boxes[BOT_START+3].x - jump;
-                end   = boxes[BOT_START+4].x + jump;
-                break;
-            case 2:
-                start = boxes[BOT_START+5].x;
-                end   = boxes[BOT_START+7].x;
-                break;
-            default:
-                log("too many columns");
-                break;
-        }
+        if (!answerColumn(boxes, jump, column, start, end))
+            log("too many columns");
 
         // Get all the bubbles (first point of an object) within this ID box. Extend
         // it a bit just to make sure we get everything.
-        const std::vector<Bubble> bubbles = findBubbles(img, blobs, data.diag,
+        const ArenaVector<Bubble> bubbles = findBubbles(img, blobs, data.diag,
              Coord(start, boxes[box].y - box_height),
              Coord(end,   boxes[box].y + box_height));
         const int radius = avgRadius(bubbles);
@@ -192,11 +200,11 @@ std::vector<Answer> findAnswers(Pixels& img, const Blobs& blobs,
     return answers;
 }
 
-std::vector<Bubble> findBubbles(Pixels& img, const Blobs& blobs, const int diag,
+ArenaVector<Bubble> findBubbles(Pixels& img, const Blobs& blobs, const int diag,
     const Coord& a, const Coord& b)
 {
-    std::vector<Bubble> bubbles;
-    const std::vector<Coord> local_blobs = blobs.in(a, b);
+    ArenaVector<Bubble> bubbles;
+    const ArenaVector<Coord> local_blobs = blobs.in(a, b);
 
     for (const Coord& object : local_blobs)
     {
@@ -226,7 +234,7 @@ std::vector<Bubble> findBubbles(Pixels& img, const Blobs& blobs, const int diag,
 }
 
 // use_x = true means use X coordinate, false means use Y coordinate
-int findFilled(Pixels& img, const Blobs& blobs, const std::vector<Bubble>& bubbles,
+int findFilled(Pixels& img, const Blobs& blobs, const ArenaVector<Bubble>& bubbles,
     const int start, const double jump, const int options, double black,
     const bool use_x, const int radius)
 {
@@ -285,7 +293,7 @@ double findBlack(Pixels& img, const Blobs& blobs, const std::vector<Coord>& boxe
     typedef std::vector<double>::size_type size_type;
 
     const double jump = 0.5*(boxes[BOT_START+1].x - boxes[BOT_START].x);
-    const std::vector<Bubble> bubbles = findBubbles(img, blobs, data.diag,
+    const ArenaVector<Bubble> bubbles = findBubbles(img, blobs, data.diag,
         Coord(boxes[BOT_START].x, boxes[ID_START-1].y),
         Coord(boxes[BOT_START].x + jump*(ID_LENGTH-1), boxes[ID_END-1].y));
     const int radius = avgRadius(bubbles);
@@ -294,6 +302,13 @@ double findBlack(Pixels& img, const Blobs& blobs, const std::vector<Coord>& boxe
     for (size_type i = 0; i < color.size(); ++i)
         color[i] = bubbleBlackness(img, blobs, bubbles[i], radius);
 
+    return blackLevel(color);
+}
+
+double blackLevel(std::vector<double> color)
+{
+    typedef std::vector<double>::size_type size_type;
+
     std::sort(color.begin(), color.end());
 
     // Find the biggest jump to know what to set the black level to. We assume
@@ -321,7 +336,7 @@ double findBlack(Pixels& img, const Blobs& blobs, const std::vector<Coord>& boxe
     return (black>0)?black:MIN_BLACK;
 }
 
-int avgRadius(const std::vector<Bubble>& bubbles)
+int avgRadius(const ArenaVector<Bubble>& bubbles)
 {
     if (bubbles.size() == 0)
         return 0;
@@ -333,3 +348,154 @@ int avgRadius(const std::vector<Bubble>& bubbles)
 
     return total/bubbles.size();
 }
+
+// Fraction of the pixels in the rectangle around c that are black
+static double rectBlackness(const Pixels& img, const Coord& c, int rx, int ry)
+{
+    int black = 0;
+
+    for (int y = c.y - ry; y <= c.y + ry; ++y)
+        for (int x = c.x - rx; x <= c.x + rx; ++x)
+            if (img.black(Coord(x, y)))
+                ++black;
+
+    return 1.0*black/((2*rx + 1)*(2*ry + 1));
+}
+
+// Fraction of the pixels in the ellipse around c that are black
+static double sampleBlackness(const Pixels& img, const Coord& c, int rx, int ry)
+{
+    int black = 0;
+    int total = 0;
+
+    for (int y = -ry; y <= ry; ++y)
+    {
+        for (int x = -rx; x <= rx; ++x)
+        {
+            if (1.0*x*x/(rx*rx) + 1.0*y*y/(ry*ry) <= 1)
+            {
+                if (img.black(Coord(c.x+x, c.y+y)))
+                    ++black;
+
+                ++total;
+            }
+        }
+    }
+
+    return (total>0)?1.0*black/total:0;
+}
+
+// Which of the bubbles is filled in, raising the black level till there's at
+// most one like findFilled() does
+static int pickFilled(const std::vector<double>& fill, double black)
+{
+    typedef std::vector<double>::size_type size_type;
+
+    int filled = DefaultFilled;
+    int count = 0;
+
+    do
+    {
+        count = 0;
+
+        for (size_type i = 0; i < fill.size(); ++i)
+        {
+            if (fill[i] > black)
+            {
+                ++count;
+                filled = i;
+            }
+        }
+
+        black += 0.05;
+    } while (black < 1 && count > 1);
+
+    return (count>0)?filled:DefaultFilled;
+}
+
+bool readAligned(const Pixels& img, const std::vector<Coord>& boxes,
+    const Data& data, long long& id, std::vector<Answer>& answers)
+{
+    const double jump = 0.5*(boxes[BOT_START+1].x - boxes[BOT_START].x);
+
+    // The middle of each bubble, and the rectangle it's drawn in
+    const int rx = std::max(1, smartFloor(ALIGNED_SAMPLE*data.width/2));
+    const int ry = std::max(1, smartFloor(rx/BUBBLE_ASPECT));
+    const int outline_rx = data.width/2;
+    const int outline_ry = std::max(1, smartFloor(outline_rx/BUBBLE_ASPECT));
+
+    // How filled in the bubble is, or -1 if there's no bubble there
+    auto fill = [&](const Coord& c) -> double
+    {
+        if (rectBlackness(img, c, outline_rx, outline_ry) < ALIGNED_OUTLINE)
+            return -1;
+
+        return sampleBlackness(img, c, rx, ry);
+    };
+
+    // The ID bubbles, a column for each digit next to the ID boxes
+    std::vector<std::vector<double>> digits(ID_LENGTH, std::vector<double>(10));
+    std::vector<double> all;
+
+    for (int i = 0; i < ID_LENGTH; ++i)
+    {
+        const int x = boxes[BOT_START].x + jump*i;
+
+        for (int digit = 0; digit < 10; ++digit)
+        {
+            const double f = fill(Coord(x, boxes[ID_START-1+digit].y));
+
+            if (f < 0)
+                return false;
+
+            digits[i][digit] = f;
+            all.push_back(f);
+        }
+    }
+
+    const double black = blackLevel(all);
+
+    long long number = 0;
+
+    for (const std::vector<double>& column : digits)
+    {
+        const int filled = pickFilled(column, black);
+
+        if (filled != DefaultFilled)
+            number = 10*number + filled;
+    }
+
+    // The answers, three columns of questions next to the question boxes
+    std::vector<Answer> found(Q_TOTAL);
+
+    for (int q = 0; q < Q_TOTAL; ++q)
+    {
+        const int column = q/(Q_END - Q_START + 1);
+        const int box = Q_START - 1 + q%(Q_END - Q_START + 1);
+        int start = 0;
+        int end   = 0;
+
+        if (!answerColumn(boxes, jump, column, start, end))
+            return false;
+
+        std::vector<double> options(Q_OPTIONS);
+
+        for (int i = 0; i < Q_OPTIONS; ++i)
+        {
+            options[i] = fill(Coord(start + jump*i, boxes[box].y));
+
+            if (options[i] < 0)
+                return false;
+        }
+
+        const int filled = pickFilled(options, black);
+
+        if (filled != DefaultFilled)
+            found[q] = (Answer)(filled+1);
+    }
+
+    id = number;
+    answers = found;
+
+    return true;
+}
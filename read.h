@@ -45,16 +45,16 @@ double bubbleBlackness(const Pixels& img, const Blobs& blobs, const Bubble& b,
     const int radius = -1);
 
 // Find all bubbles within the rectangle from p1 to p2
-std::vector<Bubble> findBubbles(Pixels& img, const Blobs& blobs, const int diag,
+ArenaVector<Bubble> findBubbles(Pixels& img, const Blobs& blobs, const int diag,
     const Coord& a, const Coord& b);
 
 // Used to even out the slight oddities in some bubbles.
-int avgRadius(const std::vector<Bubble>& bubbles);
+int avgRadius(const ArenaVector<Bubble>& bubbles);
 
 // Find filled bubble out of a vector of possible bubbles either aligned
 // vertically or horizontally (use_x true is horizontal, otherwise vertical).
 // Radius is just passed in to bubbleBlackness().
-int findFilled(Pixels& img, const Blobs& blobs, const std::vector<Bubble>& bubbles,
+int findFilled(Pixels& img, const Blobs& blobs, const ArenaVector<Bubble>& bubbles,
     const int start, const double jump, const int options, double black,
     const bool use_x, const int radius = -1);
 
@@ -64,4 +64,15 @@ int findFilled(Pixels& img, const Blobs& blobs, const std::vector<Bubble>& bubbl
 double findBlack(Pixels& img, const Blobs& blobs, const std::vector<Coord>& boxes,
     const Data& data);
 
+// The middle of the largest jump in how filled in these bubbles are, or
+// MIN_BLACK if there isn't one
+double blackLevel(std::vector<double> color);
+
+// For pages from findAlignedBoxes(), read the ID and answers without labeling
+// by looking at how much of the middle of each bubble is black where the boxes
+// say it has to be. Returns false if some bubble isn't there, e.g. it's a
+// slightly different form, so it can be done the usual way instead.
+bool readAligned(const Pixels& img, const std::vector<Coord>& boxes,
+    const Data& data, long long& id, std::vector<Answer>& answers);
+
 #endif
@@ -0,0 +1,143 @@
+#!/bin/bash
+#
+# Run several "freetron --worker" processes on a spool on this machine, kill
+# one and optionally stall another while they work, and check that every job
+# is collected exactly once.
+#
+# Usage: scripts/spooltest.sh [./freetron] [scan.pdf]
+#
+# Set WORKERS and JOBS to change how many, KEY to the key ID to grade with,
+# STALL to the seconds to stop a worker for (over SPOOL_LEASE so it loses its
+# leases), and TIMEOUT to how long to wait for all the results. The killed
+# worker's jobs are only taken over once their leases expire, so this takes
+# at least SPOOL_LEASE seconds.
+
+freetron="${1:-./freetron}"
+scan="${2:-examples/freetron_example.pdf}"
+workers="${WORKERS:-4}"
+jobs="${JOBS:-20}"
+key="${KEY:--1}"
+stall="${STALL:-0}"
+timeout="${TIMEOUT:-600}"
+
+if [[ ! -x $freetron || ! -f $scan ]]; then
+    echo "Usage: $0 [./freetron] [scan.pdf]" >&2
+    exit 1
+fi
+
+dir="$(mktemp -d)"
+spool="$dir/spool"
+collected="$dir/collected"
+pids=()
+
+cleanup() {
+    for pid in "${pids[@]}"; do
+        kill -CONT "$pid" 2>/dev/null
+        kill -KILL "$pid" 2>/dev/null
+    done
+
+    wait 2>/dev/null
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+mkdir -p "$spool"/{jobs,leases,results,tmp} "$collected"
+
+# Like Spool::submit, the job file last so workers only see complete jobs
+ext="${scan##*.}"
+
+for ((id = 1; id <= jobs; ++id)); do
+    cp "$scan" "$spool/jobs/$id.$ext"
+    echo "$key $id.$ext" > "$spool/tmp/$id.job"
+    mv "$spool/tmp/$id.job" "$spool/jobs/$id.job"
+done
+
+for ((i = 0; i < workers; ++i)); do
+    "$freetron" --worker "$spool" > "$dir/worker$i.log" 2>&1 &
+    pids+=($!)
+done
+
+echo "$workers workers on $jobs jobs in $spool"
+
+# Like Spool::collect, noticing a result for a job we already have
+count=0
+duplicates=0
+killed=0
+stalled=0
+start=$SECONDS
+
+while (( count < jobs && SECONDS - start < timeout )); do
+    for result in "$spool"/results/*; do
+        [[ -f $result ]] || continue
+        id="${result##*/}"
+
+        if [[ -e $collected/$id ]]; then
+            echo "Error: job $id collected twice" >&2
+            ((++duplicates))
+        else
+            ((++count))
+        fi
+
+        mv "$result" "$collected/$id"
+    done
+
+    # Once they're busy, kill the first worker mid-job and stop the second
+    if (( !killed && (count > 0 || SECONDS - start > 5) )); then
+        echo "killing worker ${pids[0]}"
+        kill -KILL "${pids[0]}"
+        wait "${pids[0]}" 2>/dev/null
+        killed=1
+
+        if (( stall > 0 && workers > 1 )); then
+            echo "stopping worker ${pids[1]} for $stall seconds"
+            kill -STOP "${pids[1]}"
+            stalled=$SECONDS
+        fi
+    fi
+
+    if (( stalled > 0 && SECONDS - stalled >= stall )); then
+        echo "resuming worker ${pids[1]}"
+        kill -CONT "${pids[1]}"
+        stalled=0
+    fi
+
+    sleep 0.2
+done
+
+# Let the rest finish what they have, then look for late duplicates
+for pid in "${pids[@]:1}"; do
+    kill -CONT "$pid" 2>/dev/null
+    kill -TERM "$pid" 2>/dev/null
+done
+
+wait 2>/dev/null
+pids=()
+
+for result in "$spool"/results/*; do
+    [[ -f $result ]] || continue
+    id="${result##*/}"
+
+    if [[ -e $collected/$id ]]; then
+        echo "Error: job $id collected twice" >&2
+        ((++duplicates))
+    else
+        ((++count))
+    fi
+
+    mv "$result" "$collected/$id"
+done
+
+left="$(ls "$spool/jobs" | wc -l)"
+lost="$(cat "$dir"/worker*.log | grep -c "lost lease")"
+
+echo "collected $count of $jobs jobs in $((SECONDS - start)) seconds," \
+    "$duplicates duplicates, $left files left in jobs/, $lost lost leases"
+
+if (( count != jobs || duplicates > 0 || left > 0 )); then
+    for log in "$dir"/worker*.log; do
+        echo "== $log"
+        cat "$log"
+    done
+
+    exit 1
+fi
@@ -0,0 +1,62 @@
+#include <vector>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+
+#include "sha256.h"
+
+Sha256::Sha256()
+{
+    SHA256_Init(&context);
+}
+
+void Sha256::update(const void* data, std::size_t length)
+{
+    SHA256_Update(&context, data, length);
+}
+
+std::string Sha256::hex()
+{
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256_Final(hash, &context);
+
+    return ::hex(hash, SHA256_DIGEST_LENGTH);
+}
+
+// See: http://stackoverflow.com/q/13784434/2698494
+std::string hex(const unsigned char* data, std::size_t length)
+{
+    std::ostringstream ss;
+
+    for (std::size_t i = 0; i < length; i++)
+        ss << std::hex << std::setw(2) << std::setfill('0') << (int)data[i];
+
+    return ss.str();
+}
+
+std::string sha256(const char* data, std::size_t length)
+{
+    Sha256 hash;
+    hash.update(data, length);
+
+    return hash.hex();
+}
+
+std::string sha256File(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+
+    if (!file.is_open())
+        throw std::runtime_error("couldn't open " + filename);
+
+    Sha256 hash;
+
+    // Don't read the whole thing into memory
+    std::vector<char> buffer(64*1024);
+
+    while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0)
+        hash.update(buffer.data(), file.gcount());
+
+    return hash.hex();
+}
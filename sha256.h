@@ -0,0 +1,41 @@
+/*
+ * SHA-256 hashes as hex strings using OpenSSL, used for the cache and for
+ * password hashes on the website
+ *
+ *   sha256(data, len)                 // all at once
+ *
+ *   Sha256 hash;                      // or a piece at a time
+ *   hash.update(header, headerLen);
+ *   hash.update(data, len);
+ *   hash.hex();
+ */
+
+#ifndef H_SHA256
+#define H_SHA256
+
+#include <string>
+#include <cstddef>
+#include <openssl/sha.h>
+
+class Sha256
+{
+    SHA256_CTX context;
+
+public:
+    Sha256();
+
+    void update(const void* data, std::size_t length);
+
+    // The hash of everything so far. Only call this once.
+    std::string hex();
+};
+
+// Lowercase hex of some bytes, e.g. a hash or a password salt
+std::string hex(const unsigned char* data, std::size_t length);
+
+// Hex SHA-256 of some data or the contents of a file, the latter throwing if
+// it can't be read
+std::string sha256(const char* data, std::size_t length);
+std::string sha256File(const std::string& filename);
+
+#endif
@@ -0,0 +1,467 @@
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "log.h"
+#include "owner.h"
+#include "spool.h"
+#include "options.h"
+#include "processor.h"
+
+// Create the directory if it's not there yet
+static std::string makeDir(const std::string& path)
+{
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+        throw std::runtime_error("couldn't create directory " + path);
+
+    return path + "/";
+}
+
+// Everything in a directory not starting with a dot
+static std::vector<std::string> list(const std::string& dir)
+{
+    std::vector<std::string> names;
+    DIR* d = opendir(dir.c_str());
+
+    if (!d)
+        return names;
+
+    while (dirent* entry = readdir(d))
+        if (entry->d_name[0] != '.')
+            names.push_back(entry->d_name);
+
+    closedir(d);
+    return names;
+}
+
+// Seconds since it was last modified, or -1 if it's not there
+static long long age(const std::string& path)
+{
+    struct stat info;
+
+    if (stat(path.c_str(), &info) != 0)
+        return -1;
+
+    return std::max(0LL, static_cast<long long>(std::time(nullptr) - info.st_mtime));
+}
+
+Spool::Spool(const std::string& dir)
+    : dir(makeDir((!dir.empty() && dir.back() == '/')?dir.substr(0, dir.size()-1):dir)),
+      jobs(makeDir(this->dir + "jobs")),
+      leases(makeDir(this->dir + "leases")),
+      results(makeDir(this->dir + "results")),
+      tmp(makeDir(this->dir + "tmp")),
+      owner(ownerName())
+{
+}
+
+bool Spool::write(const std::string& filename, const std::string& contents)
+{
+    const std::string temporary = tmp + owner + "-" +
+        filename.substr(filename.find_last_of('/') + 1);
+
+    int fd = open(temporary.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        return false;
+
+    const char* p = contents.c_str();
+    std::size_t left = contents.size();
+
+    while (left > 0)
+    {
+        const ssize_t written = ::write(fd, p, left);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        if (written <= 0)
+            break;
+
+        p += written;
+        left -= written;
+    }
+
+    const bool ok = left == 0 && fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || std::rename(temporary.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool Spool::readJob(long long id, long long& key, std::string& scan)
+{
+    std::ifstream file(jobs + std::to_string(id) + ".job");
+    std::string name;
+
+    if (!(file >> key >> name) || name.find('/') != std::string::npos)
+        return false;
+
+    scan = jobs + name;
+    return true;
+}
+
+bool Spool::submit(long long id, long long key, const std::string& filename)
+{
+    const std::string job = jobs + std::to_string(id) + ".job";
+
+    // Already submitted before we were restarted
+    if (age(job) >= 0 || age(results + std::to_string(id)) >= 0)
+        return true;
+
+    const std::string::size_type slash = filename.find_last_of('/');
+    const std::string::size_type dot = filename.find_last_of('.');
+    const std::string name = std::to_string(id) +
+        ((dot != std::string::npos && (slash == std::string::npos || dot > slash))?
+         filename.substr(dot):"");
+    const std::string scan = jobs + name;
+
+    // Link it if it's on the same filesystem, otherwise copy it
+    if (link(filename.c_str(), scan.c_str()) != 0 && errno != EEXIST)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        std::ofstream out(scan, std::ios::binary);
+
+        if (!in || !out || !(out << in.rdbuf()) || !out.flush())
+        {
+            std::remove(scan.c_str());
+            return false;
+        }
+    }
+
+    // Workers only see it once this is there
+    return write(job, std::to_string(key) + " " + name + "\n");
+}
+
+bool Spool::withdraw(long long id)
+{
+    // With the lease, no worker can take it while we remove it
+    if (!lease(id))
+        return false;
+
+    long long key;
+    std::string scan;
+
+    if (readJob(id, key, scan))
+        std::remove(scan.c_str());
+
+    const bool removed = std::remove((jobs + std::to_string(id) + ".job").c_str()) == 0;
+    std::remove((leases + std::to_string(id)).c_str());
+
+    return removed;
+}
+
+void Spool::collect(const SpoolCallback& callback)
+{
+    for (const std::string& name : list(results))
+    {
+        const std::string filename = results + name;
+        long long id;
+        std::size_t summaryLength;
+        std::size_t exportedLength;
+
+        {
+            std::ifstream file(filename, std::ios::binary);
+
+            try
+            {
+                id = std::stoll(name);
+            }
+            catch (const std::logic_error&)
+            {
+                continue;
+            }
+
+            std::string summary;
+            std::string exported;
+
+            if (file >> summaryLength >> exportedLength && file.get() == '\n')
+            {
+                summary.resize(summaryLength);
+                exported.resize(exportedLength);
+                file.read(&summary[0], summaryLength);
+                file.read(&exported[0], exportedLength);
+            }
+
+            if (!file)
+                log("invalid result for form " + std::to_string(id) + " in spool");
+            else
+                callback(id, summary, exported);
+        }
+
+        std::remove(filename.c_str());
+    }
+}
+
+bool Spool::lease(long long id)
+{
+    const std::string filename = leases + std::to_string(id);
+
+    // Once more after breaking an expired lease
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        int fd = open(filename.c_str(), O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+
+        if (fd >= 0)
+        {
+            const std::string contents = owner + "\n";
+            const bool ok = ::write(fd, contents.c_str(), contents.size()) ==
+                static_cast<ssize_t>(contents.size());
+            close(fd);
+
+            if (!ok)
+                std::remove(filename.c_str());
+
+            return ok;
+        }
+
+        if (errno != EEXIST)
+            return false;
+
+        const long long held = age(filename);
+
+        // Released since we tried, otherwise see if it expired
+        if (held < 0)
+            continue;
+
+        if (held < SPOOL_LEASE)
+            return false;
+
+        // Move it aside first so only one of us breaks it
+        const std::string broken = tmp + owner + "-lease-" + std::to_string(id);
+
+        if (std::rename(filename.c_str(), broken.c_str()) != 0)
+            return false;
+
+        // If it was renewed or replaced right before we moved it, put it back
+        const long long moved = age(broken);
+
+        if (moved >= 0 && moved < SPOOL_LEASE)
+        {
+            if (link(broken.c_str(), filename.c_str()) != 0)
+                log("couldn't restore lease on job " + std::to_string(id));
+
+            std::remove(broken.c_str());
+            return false;
+        }
+
+        std::remove(broken.c_str());
+        log("lease on job " + std::to_string(id) + " expired, taking it over",
+            LogType::Notice);
+    }
+
+    return false;
+}
+
+bool Spool::claim(SpoolJob& job, const std::set<long long>& skip)
+{
+    std::vector<long long> ids;
+
+    for (const std::string& name : list(jobs))
+    {
+        if (name.size() <= 4 || name.compare(name.size() - 4, 4, ".job") != 0)
+            continue;
+
+        try
+        {
+            ids.push_back(std::stoll(name));
+        }
+        catch (const std::logic_error&)
+        {
+        }
+    }
+
+    // Oldest first
+    std::sort(ids.begin(), ids.end());
+
+    for (long long id : ids)
+    {
+        // Done, just not collected yet
+        if (skip.count(id) || age(results + std::to_string(id)) >= 0)
+            continue;
+
+        if (!lease(id))
+            continue;
+
+        // It may have been finished or withdrawn while we were looking
+        if (!readJob(id, job.key, job.filename))
+        {
+            std::remove((leases + std::to_string(id)).c_str());
+            continue;
+        }
+
+        job.id = id;
+        return true;
+    }
+
+    return false;
+}
+
+bool Spool::holds(long long id)
+{
+    std::ifstream file(leases + std::to_string(id));
+    std::string name;
+
+    return std::getline(file, name) && name == owner;
+}
+
+void Spool::release(long long id)
+{
+    if (holds(id))
+        std::remove((leases + std::to_string(id)).c_str());
+}
+
+bool Spool::renew(long long id)
+{
+    if (!holds(id) || utimes((leases + std::to_string(id)).c_str(), nullptr) != 0)
+    {
+        log("lost lease on job " + std::to_string(id), LogType::Warning);
+        return false;
+    }
+
+    return true;
+}
+
+void Spool::complete(long long id, const std::string& summary,
+    const std::string& exported)
+{
+    // We stalled long enough that somebody else took it over, so it's theirs
+    // to finish
+    if (!holds(id))
+    {
+        log("lost lease on job " + std::to_string(id) + ", dropping it",
+            LogType::Warning);
+        return;
+    }
+
+    std::ostringstream s;
+    s << summary.size() << " " << exported.size() << "\n" << summary << exported;
+
+    // If this fails, our lease expires and somebody tries again
+    if (!write(results + std::to_string(id), s.str()))
+    {
+        log("couldn't write results of job " + std::to_string(id) + " to spool");
+        return;
+    }
+
+    long long key;
+    std::string scan;
+
+    if (readJob(id, key, scan))
+        std::remove(scan.c_str());
+
+    std::remove((jobs + std::to_string(id) + ".job").c_str());
+    std::remove((leases + std::to_string(id)).c_str());
+}
+
+SpoolWorker::SpoolWorker(Processor& p, Spool& spool)
+    : p(p), spool(spool)
+{
+    p.onFinish([this](Form& form) { finish(form); });
+}
+
+void SpoolWorker::finish(Form& form)
+{
+    // Canceled since we lost the lease
+    if (!form.canceled)
+        spool.complete(form.id, p.print(form), p.csv(form));
+
+    std::unique_lock<std::mutex> lck(lock);
+    running.erase(form.id);
+}
+
+void SpoolWorker::run(const std::atomic_bool& stop)
+{
+    std::chrono::steady_clock::time_point renewed = std::chrono::steady_clock::now();
+
+    while (true)
+    {
+        std::vector<long long> ours;
+
+        {
+            std::unique_lock<std::mutex> lck(lock);
+            ours.assign(running.begin(), running.end());
+        }
+
+        if (stop && ours.empty())
+            break;
+
+        // Keep our leases from expiring
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        if (now - renewed >= std::chrono::seconds(SPOOL_HEARTBEAT))
+        {
+            for (long long id : ours)
+            {
+                // Somebody else has it now, so stop and make room for another
+                if (!spool.renew(id))
+                {
+                    p.cancel(id);
+                    canceled.insert(id);
+
+                    std::unique_lock<std::mutex> lck(lock);
+                    running.erase(id);
+                }
+            }
+
+            renewed = now;
+        }
+
+        // Once a canceled form is gone, we can take its job again, e.g. if
+        // whoever took it over died too
+        for (std::set<long long>::iterator i = canceled.begin(); i != canceled.end(); )
+            i = p.done(*i)?canceled.erase(i):std::next(i);
+
+        // Take more while we have room
+        for (std::size_t count = ours.size(); !stop && count < SPOOL_FORMS; ++count)
+        {
+            SpoolJob job;
+
+            if (!spool.claim(job, canceled))
+                break;
+
+            {
+                std::unique_lock<std::mutex> lck(lock);
+                running.insert(job.id);
+            }
+
+            try
+            {
+                p.add(job.id, job.key, job.filename);
+            }
+            catch (const std::runtime_error& e)
+            {
+                // E.g. it's still in the Processor some other way, so leave
+                // it for somebody else till it's gone
+                log("couldn't start job " + std::to_string(job.id) + ": " + e.what());
+                spool.release(job.id);
+                canceled.insert(job.id);
+
+                std::unique_lock<std::mutex> lck(lock);
+                running.erase(job.id);
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(SPOOL_POLL_MS));
+    }
+
+    p.wait();
+}
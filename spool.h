@@ -0,0 +1,143 @@
+/*
+ * Hand forms from the website to worker processes through a spool directory,
+ * so processing can be spread over several processes or several machines
+ * sharing a filesystem
+ *
+ * The website links each upload into jobs/ along with a job file saying what
+ * its key is. A worker claims a job by creating its lease file in leases/,
+ * which only one can do, and renews it every SPOOL_HEARTBEAT seconds while
+ * processing the form. A lease not renewed for SPOOL_LEASE seconds is from a
+ * worker that died, so another worker breaks it and takes the job. A worker
+ * that was only stalled finds somebody else's name in the lease when it next
+ * renews or completes the job and drops the form instead. Results
+ * are written to results/, where the website collects them and saves them to
+ * the database. Every file is written elsewhere first and then renamed into
+ * place, so nobody ever reads half of one.
+ *
+ *   jobs/<id>.job      key and the name of the scan
+ *   jobs/<id>.pdf      the scan (or .tif, .png, .jpg)
+ *   leases/<id>        who has it, renewed by updating the modification time
+ *   results/<id>       the summary and the CSV export
+ *
+ * The machines' clocks have to agree to within much less than SPOOL_LEASE.
+ *
+ * Example:
+ *
+ *   Spool spool("spool");
+ *   spool.submit(id, key, "uploads/1.pdf");      // website
+ *   SpoolWorker(p, spool).run(stop);             // freetron --worker spool
+ *   spool.collect([](long long id, const std::string& summary,
+ *       const std::string& exported) { });       // website
+ */
+
+#ifndef H_SPOOL
+#define H_SPOOL
+
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <functional>
+
+#include "forms.h"
+
+class Processor;
+
+// A job a worker has claimed
+struct SpoolJob
+{
+    long long id;
+    long long key;
+    std::string filename;
+};
+
+// Called with the results of a form a worker finished
+typedef std::function<void(long long id, const std::string& summary,
+        const std::string& exported)> SpoolCallback;
+
+class Spool
+{
+    const std::string dir;
+    const std::string jobs;
+    const std::string leases;
+    const std::string results;
+    const std::string tmp;
+
+    // Who we are in lease files and temporary filenames, unique across
+    // machines
+    const std::string owner;
+
+public:
+    // Create the subdirectories if needed, throwing if they can't be
+    explicit Spool(const std::string& dir);
+
+    // Website: add a job for this form unless it's already there, e.g. when
+    // resuming after a restart. Returns false if it couldn't be written.
+    bool submit(long long id, long long key, const std::string& filename);
+
+    // Website: remove a job if no worker has it, returning whether we did
+    bool withdraw(long long id);
+
+    // Website: pass on and then delete each result the workers wrote
+    void collect(const SpoolCallback& callback);
+
+    // Worker: claim the oldest job nobody has or whose lease expired other
+    // than those to skip, returning false if there isn't one
+    bool claim(SpoolJob& job, const std::set<long long>& skip = std::set<long long>());
+
+    // Worker: give back a job we claimed but can't work on
+    void release(long long id);
+
+    // Worker: we're still working on it. Returns false if the lease isn't
+    // ours anymore, so somebody else is working on it now.
+    bool renew(long long id);
+
+    // Worker: write the results and delete the job and our lease, unless the
+    // lease isn't ours anymore
+    void complete(long long id, const std::string& summary,
+        const std::string& exported);
+
+private:
+    // Whether the lease file for this job still has our name in it
+    bool holds(long long id);
+
+    // Take the lease for this job if nobody has it or it expired
+    bool lease(long long id);
+
+    // Write to a temporary file, sync it, and rename it into place
+    bool write(const std::string& filename, const std::string& contents);
+
+    // The job file's key and scan filename, false if it's not there
+    bool readJob(long long id, long long& key, std::string& scan);
+};
+
+// The main loop of "freetron --worker spool/", claiming up to SPOOL_FORMS
+// jobs at a time and processing them with the Processor
+class SpoolWorker
+{
+    Processor& p;
+    Spool& spool;
+
+    // Jobs we're working on. Forms finish on the worker threads.
+    std::mutex lock;
+    std::set<long long> running;
+
+    // Jobs we lost the lease on and canceled, or otherwise couldn't add,
+    // that are still in the Processor, which we can't add again till they're
+    // gone
+    std::set<long long> canceled;
+
+public:
+    // Takes over the Processor's onFinish
+    SpoolWorker(Processor& p, Spool& spool);
+
+    // Process jobs till stop is set, e.g. by a signal handler, and then
+    // finish the ones we have, still renewing their leases
+    void run(const std::atomic_bool& stop);
+
+private:
+    // Write the results back. Called on the worker threads.
+    void finish(Form& form);
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include <algorithm>
+
+#include "statuschannels.h"
+
+StatusChannels::StatusChannels()
+    : nextId(0)
+{
+}
+
+StatusChannels::Shard& StatusChannels::shard(long long formId)
+{
+    return shards[static_cast<unsigned long long>(formId)%shards.size()];
+}
+
+long long StatusChannels::subscribe(long long formId,
+        const StatusCallback& callback)
+{
+    const long long id = nextId++;
+
+    Shard& s = shard(formId);
+    std::unique_lock<std::mutex> lock(s.lock);
+    Channel& c = s.channels[formId];
+
+    // Missed an update, so no need to wait
+    if (c.pending)
+    {
+        c.pending = false;
+        callback(id, Status(formId, c.percentage));
+
+        if (c.subscribers.empty())
+            s.channels.erase(formId);
+    }
+    else
+    {
+        c.subscribers.push_back(Subscriber(id, callback));
+    }
+
+    return id;
+}
+
+bool StatusChannels::unsubscribe(long long formId, long long subscription)
+{
+    Shard& s = shard(formId);
+    std::unique_lock<std::mutex> lock(s.lock);
+
+    std::unordered_map<long long, Channel>::iterator c = s.channels.find(formId);
+
+    if (c == s.channels.end())
+        return false;
+
+    std::vector<Subscriber>& subscribers = c->second.subscribers;
+    std::vector<Subscriber>::iterator i = std::find_if(
+            subscribers.begin(), subscribers.end(),
+            [subscription](const Subscriber& sub) { return sub.id == subscription; });
+
+    if (i == subscribers.end())
+        return false;
+
+    subscribers.erase(i);
+
+    if (subscribers.empty() && !c->second.pending)
+        s.channels.erase(c);
+
+    return true;
+}
+
+void StatusChannels::publish(const Status& status)
+{
+    Shard& s = shard(status.formId);
+    std::unique_lock<std::mutex> lock(s.lock);
+    Channel& c = s.channels[status.formId];
+
+    if (c.subscribers.empty())
+    {
+        // Keep only the latest for whoever subscribes next
+        c.pending = true;
+        c.percentage = status.percentage;
+    }
+    else
+    {
+        for (const Subscriber& sub : c.subscribers)
+            sub.callback(sub.id, status);
+
+        c.subscribers.clear();
+        c.pending = false;
+    }
+
+    // Nobody needs to wait on a finished form
+    if (status.percentage >= 100 || !c.pending)
+        s.channels.erase(status.formId);
+}
@@ -0,0 +1,106 @@
+/*
+ * Status updates for each form, sent to whoever is waiting on that form
+ *
+ * Each form has its own channel, so publishing an update only touches the
+ * subscribers of that form. Subscriptions are one-shot, like a long polling
+ * request: the callback gets the next update and is then removed. Updates
+ * published while nobody is subscribed are coalesced so the next subscriber
+ * immediately gets the latest one rather than every one it missed.
+ *
+ * Example:
+ *
+ *   StatusChannels channels;
+ *   long long s = channels.subscribe(id, [](long long, const Status&) { });
+ *   channels.publish(Status(id, 50)); // calls the callback
+ *   channels.unsubscribe(id, s);      // if it hadn't been called yet
+ */
+
+#ifndef H_STATUSCHANNELS
+#define H_STATUSCHANNELS
+
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+#include "options.h"
+
+// For sending status updates
+struct Status
+{
+    long long formId;
+    int percentage;
+
+    Status(long long formId, int percentage)
+        : formId(formId), percentage(percentage)
+    {
+    }
+};
+
+// Called with the subscription ID and the update. This is called with the
+// channel locked, so it should just hand it off somewhere and not subscribe or
+// unsubscribe.
+typedef std::function<void(long long subscription, const Status&)> StatusCallback;
+
+class StatusChannels
+{
+    struct Subscriber
+    {
+        long long id;
+        StatusCallback callback;
+
+        Subscriber(long long id, const StatusCallback& callback)
+            : id(id), callback(callback)
+        {
+        }
+    };
+
+    struct Channel
+    {
+        std::vector<Subscriber> subscribers;
+
+        // Latest update that nobody has gotten yet
+        bool pending;
+        int percentage;
+
+        Channel()
+            : pending(false), percentage(0)
+        {
+        }
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::unordered_map<long long, Channel> channels;
+    };
+
+    std::array<Shard, FORM_SHARDS> shards;
+    std::atomic<long long> nextId;
+
+public:
+    StatusChannels();
+
+    StatusChannels(const StatusChannels&) = delete;
+    StatusChannels& operator=(const StatusChannels&) = delete;
+
+    // Call the callback once with the next update for this form, or right
+    // away if there's one nobody has gotten yet. Returns an ID for
+    // unsubscribing.
+    long long subscribe(long long formId, const StatusCallback& callback);
+
+    // Returns false if the callback was already called. Once this returns,
+    // the callback won't be called.
+    bool unsubscribe(long long formId, long long subscription);
+
+    // Send an update to everybody subscribed to this form. Once a form is
+    // done (100%), its channel is removed.
+    void publish(const Status& status);
+
+private:
+    Shard& shard(long long formId);
+};
+
+#endif
@@ -0,0 +1,400 @@
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "log.h"
+#include "read.h"
+#include "owner.h"
+#include "watch.h"
+#include "options.h"
+#include "processor.h"
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+// Part after the last slash
+static std::string basename(const std::string& path)
+{
+    const std::string::size_type slash = path.find_last_of('/');
+    return (slash == std::string::npos)?path:path.substr(slash+1);
+}
+
+static bool endsWith(const std::string& s, const std::string& end)
+{
+    return s.size() >= end.size() &&
+        s.compare(s.size() - end.size(), end.size(), end) == 0;
+}
+
+static bool isFile(const std::string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+// Everything in a directory not starting with a dot
+static std::vector<std::string> list(const std::string& path)
+{
+    std::vector<std::string> names;
+    DIR* d = opendir(path.c_str());
+
+    if (!d)
+        return names;
+
+    while (dirent* entry = readdir(d))
+        if (entry->d_name[0] != '.')
+            names.push_back(entry->d_name);
+
+    closedir(d);
+
+    return names;
+}
+
+// The name with -1, -2, etc. before the extension
+static std::string numbered(const std::string& name, int n)
+{
+    if (n == 0)
+        return name;
+
+    const std::string::size_type dot = name.find_last_of('.');
+    const std::string::size_type split = (dot == std::string::npos || dot == 0)?
+        name.size():dot;
+
+    return name.substr(0, split) + "-" + std::to_string(n) + name.substr(split);
+}
+
+// Move the file into the directory without replacing one of the same name
+// that's there, numbering it instead. Linking fails if the name is taken,
+// unlike renaming, but isn't supported everywhere, e.g. on some network
+// shares, so then we rename if nothing's there. Returns the name used or an
+// empty string if we couldn't move it.
+static std::string moveInto(const std::string& from, const std::string& to,
+    const std::string& name)
+{
+    for (int n = 0; n < 1000; ++n)
+    {
+        const std::string target = to + numbered(name, n);
+
+        if (link(from.c_str(), target.c_str()) == 0)
+        {
+            unlink(from.c_str());
+            return numbered(name, n);
+        }
+
+        if (errno == EEXIST)
+            continue;
+
+        struct stat info;
+
+        if (lstat(target.c_str(), &info) == 0)
+            continue;
+
+        if (std::rename(from.c_str(), target.c_str()) == 0)
+            return numbered(name, n);
+
+        break;
+    }
+
+    return "";
+}
+
+// Create the directory if it's not there yet
+static void makeDir(const std::string& path)
+{
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+        throw std::runtime_error("couldn't create directory " + path);
+}
+
+HotFolder::HotFolder(Processor& p, const std::string& dir, long long defaultKey,
+        bool csv, const std::string& outputDir)
+    : p(p),
+      dir((!dir.empty() && dir.back() == '/')?dir:dir + "/"),
+      claims(this->dir + WATCH_CLAIMED + "/"),
+      claimed(claims + ownerName() + "/"),
+      done(this->dir + WATCH_DONE + "/"),
+      defaultKey(defaultKey),
+      output(csv, outputDir.empty()?done:outputDir, std::cout, false),
+      next(0)
+{
+    struct stat info;
+
+    if (stat(this->dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+        throw std::runtime_error("couldn't find directory " + this->dir);
+
+    makeDir(claims);
+    makeDir(claimed);
+    makeDir(done);
+
+    p.onFinish([this](Form& form) { finish(form); });
+}
+
+long long HotFolder::key(const std::string& name) const
+{
+    std::ifstream sidecar(dir + name + ".key");
+    long long id;
+
+    if (sidecar >> id && id != DefaultID)
+        return id;
+
+    // Otherwise at the start of the filename, e.g. 1793240_section1.pdf
+    std::string::size_type digits = 0;
+
+    while (digits < name.size() && std::isdigit(name[digits]))
+        ++digits;
+
+    if (digits > 0 && digits < name.size() &&
+        (name[digits] == '_' || name[digits] == '-'))
+    {
+        try
+        {
+            return std::stoll(name.substr(0, digits));
+        }
+        catch (const std::out_of_range&)
+        {
+        }
+    }
+
+    return defaultKey;
+}
+
+void HotFolder::claim(const std::string& name)
+{
+    // Ours, or something the copier is still writing under a temporary name
+    if (name.empty() || name[0] == '.')
+        return;
+
+    // The key showed up after the scan did
+    if (endsWith(name, ".key"))
+    {
+        const std::string scan = name.substr(0, name.size() - 4);
+
+        if (isScan(scan) && isFile(dir + scan))
+            claim(scan);
+
+        return;
+    }
+
+    if (!isScan(name) || !isFile(dir + name))
+        return;
+
+    const long long id = key(name);
+
+    if (id == DefaultID)
+    {
+        log("no key for " + dir + name + ", waiting for " + name + ".key",
+            LogType::Notice);
+        return;
+    }
+
+    // Each claim gets its own directory, so renaming into it can't replace
+    // another scan of the same name that's still being graded
+    const long long number = next++;
+    const std::string into = claimed + std::to_string(number) + "/";
+
+    if (mkdir(into.c_str(), 0755) != 0)
+    {
+        log("couldn't create directory " + into);
+        return;
+    }
+
+    // If somebody else got it first, it's not there anymore
+    if (std::rename((dir + name).c_str(), (into + name).c_str()) != 0)
+    {
+        rmdir(into.c_str());
+        return;
+    }
+
+    // Keep the sidecar with the scan so we still have it if we're restarted
+    if (isFile(dir + name + ".key"))
+        std::rename((dir + name + ".key").c_str(), (into + name + ".key").c_str());
+
+    p.add(number, id, into + name);
+}
+
+void HotFolder::unclaim()
+{
+    const std::string ours = basename(claimed.substr(0, claimed.size()-1));
+
+    for (const std::string& name : list(claims))
+    {
+        if (name == ours)
+            continue;
+
+        struct stat info;
+
+        if (stat((claims + name).c_str(), &info) != 0)
+            continue;
+
+        // Scans claimed before each instance had its own directory, or
+        // instances that are gone or haven't touched theirs in a while
+        if (S_ISREG(info.st_mode) || ownerGone(name) ||
+            (S_ISDIR(info.st_mode) && time(nullptr) - info.st_mtime > WATCH_ABANDONED))
+            putBack(name);
+    }
+}
+
+void HotFolder::putBack(const std::string& name)
+{
+    // Only one of us can move it, so the scans aren't put back twice
+    const std::string adopted = claimed + "." + name;
+
+    if (std::rename((claims + name).c_str(), adopted.c_str()) != 0)
+        return;
+
+    log("putting back scans claimed by " + name, LogType::Notice);
+
+    if (isFile(adopted))
+    {
+        if (moveInto(adopted, dir, name).empty())
+            log("couldn't move " + adopted + " to " + dir);
+
+        return;
+    }
+
+    // The directory for each claim, or files directly in it from before
+    for (const std::string& number : list(adopted))
+    {
+        const std::string path = adopted + "/" + number;
+
+        if (isFile(path))
+        {
+            if (moveInto(path, dir, number).empty())
+                log("couldn't move " + path + " to " + dir);
+
+            continue;
+        }
+
+        // Key first so the scan's claimed with it
+        std::vector<std::string> files = list(path);
+        std::sort(files.begin(), files.end(), [](const std::string& a, const std::string& b)
+            { return endsWith(a, ".key") > endsWith(b, ".key"); });
+
+        for (const std::string& file : files)
+            if (moveInto(path + "/" + file, dir, file).empty())
+                log("couldn't move " + path + "/" + file + " to " + dir);
+
+        rmdir(path.c_str());
+    }
+
+    rmdir(adopted.c_str());
+}
+
+void HotFolder::claimAll()
+{
+    std::vector<std::string> names = list(dir);
+
+    // Oldest first if they're named by time like copiers usually do
+    std::sort(names.begin(), names.end());
+
+    for (const std::string& name : names)
+        claim(name);
+}
+
+void HotFolder::finish(Form& form)
+{
+    const std::string name = basename(form.filename);
+    const std::string into = form.filename.substr(0, form.filename.size() - name.size());
+
+    // Numbered if a scan of the same name was graded before
+    const std::string moved = moveInto(form.filename, done, name);
+
+    if (moved.empty())
+        log("couldn't move " + form.filename + " to " + done);
+    else if (isFile(into + name + ".key"))
+        std::rename((into + name + ".key").c_str(), (done + moved + ".key").c_str());
+
+    // Named after the scan in done/, and never over earlier results
+    output.write(p, form, moved.empty()?name:moved);
+
+    rmdir(into.c_str());
+}
+
+#if defined(linux) || defined(__linux) || defined(__linux__)
+void HotFolder::run(const std::atomic_bool& stop)
+{
+    int fd = inotify_init1(IN_CLOEXEC);
+
+    if (fd < 0)
+        throw std::runtime_error("couldn't start watching " + dir);
+
+    // Watch before listing so nothing that shows up in between is missed.
+    // Closed after writing, not created, so we don't take half a scan.
+    if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE|IN_MOVED_TO) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("couldn't watch " + dir);
+    }
+
+    unclaim();
+    claimAll();
+
+    // Events are aligned like inotify_event
+    std::vector<inotify_event> events(64 + 4096/sizeof(inotify_event));
+    char* buffer = reinterpret_cast<char*>(events.data());
+    const std::size_t bufferSize = events.size()*sizeof(inotify_event);
+
+    while (!stop)
+    {
+        // So others watching the folder know we're still here
+        utimes(claimed.c_str(), nullptr);
+
+        // Wake up now and then in case the signal came right before this
+        pollfd ready;
+        ready.fd = fd;
+        ready.events = POLLIN;
+
+        if (poll(&ready, 1, 1000) <= 0)
+            continue;
+
+        const ssize_t len = read(fd, buffer, bufferSize);
+
+        if (len <= 0)
+            continue;
+
+        for (ssize_t i = 0; i < len; )
+        {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + i);
+            i += sizeof(inotify_event) + event->len;
+
+            // Missed some, so look at everything again
+            if (event->mask & IN_Q_OVERFLOW)
+                claimAll();
+            else if (event->len > 0 && !(event->mask & IN_ISDIR))
+                claim(event->name);
+        }
+    }
+
+    close(fd);
+
+    // Finish what we've claimed, still touching our claims so they aren't
+    // taken. If we're killed first, they're put back next time one of us
+    // starts.
+    std::atomic_bool finished(false);
+    std::thread waiter([this, &finished]() { p.wait(); finished = true; });
+
+    while (!finished)
+    {
+        utimes(claimed.c_str(), nullptr);
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    waiter.join();
+    rmdir(claimed.c_str());
+}
+#else
+void HotFolder::run(const std::atomic_bool&)
+{
+    throw std::runtime_error("watching a directory isn't supported on this OS");
+}
+#endif
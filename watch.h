@@ -0,0 +1,87 @@
+/*
+ * Grade the scans a copier drops in a directory as soon as they show up
+ *
+ * New files are noticed with inotify when they're closed after being written
+ * or are moved in, so the directory is only ever listed once at startup. Each
+ * scan is claimed by renaming it into dir/.processing/<host>-<pid>/<n>/, which
+ * only one instance watching the folder can do, so it's never graded twice or
+ * while it's still being written. When it's done, the results are written to
+ * dir/done/ (or the output directory) and the scan is moved to dir/done/,
+ * numbered if there's already one with that name.
+ *
+ * At startup, scans claimed by instances that aren't running anymore are put
+ * back, i.e. when the process is gone if it was on this machine or else when
+ * its claims haven't been touched for WATCH_ABANDONED seconds.
+ *
+ * The key is the ID in a sidecar file next to the scan, e.g. scan.pdf.key
+ * containing 1793240, or at the start of the filename followed by an
+ * underscore or dash, e.g. 1793240_section1.pdf, or else the default. Scans
+ * without a key are left alone till their sidecar file shows up.
+ *
+ * Example:
+ *
+ *   HotFolder folder(p, "scans/", DefaultID, true);
+ *   folder.run(stop);
+ */
+
+#ifndef H_WATCH
+#define H_WATCH
+
+#include <atomic>
+#include <string>
+
+#include "batch.h"
+#include "forms.h"
+
+class Processor;
+
+class HotFolder
+{
+    Processor& p;
+    const std::string dir;
+    const std::string claims;
+    const std::string claimed;
+    const std::string done;
+    const long long defaultKey;
+    BatchOutput output;
+
+    // IDs for the forms we give the Processor
+    long long next;
+
+public:
+    // Create dir/.processing/<host>-<pid>/ and dir/done/ if needed, throwing
+    // if they can't be. Results are written to outputDir if given. Takes over
+    // the Processor's onFinish, so add forms only through this.
+    HotFolder(Processor& p, const std::string& dir, long long defaultKey,
+        bool csv, const std::string& outputDir = "");
+
+    // Grade what's already there and then each new scan till stop is set,
+    // e.g. by a signal handler, and then wait for the ones claimed to finish.
+    // Throws if we can't watch the directory.
+    void run(const std::atomic_bool& stop);
+
+private:
+    // Claim and start grading this scan in dir if it has a key. Given a
+    // sidecar file, tries the scan it's for.
+    void claim(const std::string& name);
+
+    // Put back scans claimed by instances that aren't running anymore
+    void unclaim();
+
+    // Put back the scans in one of the directories in dir/.processing/ after
+    // moving it into ours so nobody else does too
+    void putBack(const std::string& name);
+
+    // List the directory once, claiming everything in it
+    void claimAll();
+
+    // The key from the scan's sidecar file or filename, DefaultID if neither
+    // has one and there's no default
+    long long key(const std::string& name) const;
+
+    // Write out the results and move the scan out of the way. This is called
+    // on the worker threads.
+    void finish(Form& form);
+};
+
+#endif
@@ -160,8 +160,13 @@ function updateAccountSubmit() {
  * Forms page
  */
 
-function isPdf(type, name) {
-    return type === "application/pdf" || name.substr(-3,3).toLowerCase() === "pdf";
+// A PDF or a scan saved as a TIFF, PNG, or JPEG
+function isScan(type, name) {
+    var ext = name.substr(name.lastIndexOf(".") + 1).toLowerCase();
+
+    return type === "application/pdf" || type === "image/tiff" ||
+        type === "image/png" || type === "image/jpeg" ||
+        ["pdf", "tif", "tiff", "png", "jpg", "jpeg"].indexOf(ext) !== -1;
 }
 
 function validKey(key) {
@@ -180,10 +185,10 @@ function fileSelected() {
     var file = $('uploadFile').files[0];
 
     if (file) {
-        if (isPdf(file.type, file.name)) {
+        if (isScan(file.type, file.name)) {
             error.innerHTML = "";
         } else {
-            fileError("Must be PDF");
+            fileError("Must be PDF, TIFF, PNG, or JPEG");
         }
     }
 }
@@ -200,8 +205,8 @@ function uploadFile() {
         fileError("Invalid file");
     } else if (!validKey(key)) {
         fileError("Key must be a number");
-    } else if (!isPdf(file.type, file.name)) {
-        fileError("Must be PDF");
+    } else if (!isScan(file.type, file.name)) {
+        fileError("Must be PDF, TIFF, PNG, or JPEG");
     } else {
         var fd;
 
@@ -219,9 +224,7 @@ function uploadFile() {
         }
 
         http("/upload/" + key,
-        uploadComplete, function(data) {
-            fileError("Error uploading file");
-        }, uploadProgress, function(evt) {
+        uploadComplete, uploadFailed, uploadProgress, function(evt) {
             fileError("Canceled");
         }, fd);
 
@@ -290,6 +293,18 @@ function uploadComplete(result) {
     }
 }
 
+// The server may be too busy to take more forms right now
+function uploadFailed(result) {
+    window.needToConfirm = false;
+
+    if (typeof result === "string" && result.substr(0, 5) === "busy ") {
+        var seconds = parseInt(result.substr(5), 10);
+        fileError("Server busy, please try again in " + seconds + " seconds");
+    } else {
+        fileError("Error uploading file");
+    }
+}
+
 // Clear it with a space, so we don't have the table moving up and down the
 // page when we upload a form
 function clearProgress() {
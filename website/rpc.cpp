@@ -11,15 +11,14 @@
 #include <booster/system_error.h>
 #include <booster/intrusive_ptr.h>
 #include <boost/bind.hpp>
-#include <openssl/sha.h>
 
 #include "rpc.h"
 #include "content.h"
+#include "../sha256.h"
 
 rpc::rpc(cppcms::service& srv, Database& db, Processor& p)
     : cppcms::rpc::json_rpc_server(srv), db(db), p(p),
-      timer(srv.get_io_service()), exiting(false),
-      statusThread(StatusThread(*this, exiting))
+      alive(std::make_shared<Alive>(this)), timer(srv.get_io_service())
 {
     // Account
     bind("account_login", cppcms::rpc::json_method(&rpc::account_login, this), method_role);
@@ -35,19 +34,33 @@ rpc::rpc(cppcms::service& srv, Database& db, Processor& p)
     bind("form_delete", cppcms::rpc::json_method(&rpc::form_delete, this), method_role);
     bind("form_rename", cppcms::rpc::json_method(&rpc::form_rename, this), method_role);
 
+    // Server
+    bind("server_status", cppcms::rpc::json_method(&rpc::server_status, this), method_role);
+
     // Timeouts for getting rid of long requests
     on_timer(booster::system::error_code());
 }
 
 rpc::~rpc()
 {
+    // Replies to status updates already posted to the event loop are dropped
+    {
+        std::unique_lock<std::mutex> lock(alive->lock);
+        alive->self = nullptr;
+    }
+
     timer.reset_io_service();
 
-    // We need to tell Processor to wake up all the statusWait() calls we're
-    // waiting on for status updates so we can exit that thread
-    exiting = true;
-    p.statusWakeAll();
-    statusThread.join();
+    // Make sure we won't get any more status updates
+    std::unordered_map<long long, ProcessRequest> remaining;
+
+    {
+        std::unique_lock<std::mutex> lock(waiters_mutex);
+        remaining.swap(waiters);
+    }
+
+    for (const std::pair<const long long, ProcessRequest>& w : remaining)
+        p.statusUnsubscribe(w.second.formId, w.first);
 }
 
 void rpc::account_login(const std::string& user, const std::string& pass)
@@ -159,32 +172,45 @@ void rpc::form_process(long long formId)
         }
         else
         {
-            // If it's not done, then save this request and process it once we
-            // are notified that this form is done, or if a timeout occurs
-            std::unique_lock<std::mutex> lock(waiters_mutex);
-
-            std::vector<ProcessRequest>::iterator i = std::find_if(
-                    waiters.begin(), waiters.end(), RequestIdPredicate(formId));
-
-            // Only save the request if it's the first one, otherwise somebody
-            // could create massive amounts of requests that hang around for up
-            // to the timeout using up server memory
-            if (i == waiters.end())
-            {
-                booster::shared_ptr<cppcms::rpc::json_call> call = release_call();
-                waiters.push_back(ProcessRequest(formId, call));
-
-                // If the connection is closed before it's done, remove the request
-                call->context().async_on_peer_reset(
-                        boost::bind(
-                            &rpc::remove_context,
-                            booster::intrusive_ptr<rpc>(this),
-                            call));
-            }
-            else
+            // If it's not done, then save this request and reply once there's
+            // another status update on this form, or if a timeout occurs
+            booster::shared_ptr<cppcms::rpc::json_call> call = release_call();
+            cppcms::service* srv = &service();
+            long long subscription;
+
+            // Hold the lock so that if the update comes right away, we've
+            // saved the request before the reply is handled in the event loop
             {
-                return_error("too many connections to this form");
+                std::unique_lock<std::mutex> lock(waiters_mutex);
+
+                // The update comes from a processing thread, so hand it off to
+                // the event loop to reply. We unsubscribe before being
+                // destroyed, so this won't be called after that, but the
+                // post may still be queued. Taking a reference to us here
+                // could bring us back once we're already being destroyed, so
+                // the reply only checks whether we still exist.
+                const std::shared_ptr<Alive> token = alive;
+                subscription = p.statusSubscribe(formId,
+                    [token, srv](long long subscription, const Status& s) {
+                        srv->post(boost::bind(&rpc::broadcastTo, token,
+                            subscription, s.formId, s.percentage));
+                    });
+
+                waiters.insert(std::make_pair(subscription,
+                            ProcessRequest(formId, call)));
             }
+
+            // If the connection is closed before it's done, remove the request
+            call->context().async_on_peer_reset(
+                    boost::bind(
+                        &rpc::remove_context,
+                        booster::intrusive_ptr<rpc>(this),
+                        subscription));
+
+            // It may have finished right before we subscribed, in which case
+            // there won't be any more updates
+            if (p.done(formId) && p.statusUnsubscribe(formId, subscription))
+                broadcast(subscription, formId, 100);
         }
     }
     else
@@ -250,6 +276,9 @@ void rpc::form_delete(long long formId)
 
         if (db.deleteForm(userId, formId))
         {
+            // Stop processing it if we still are
+            p.cancel(formId);
+
             return_result(true);
             return;
         }
@@ -269,6 +298,27 @@ void rpc::form_rename()
     return_result(false);
 }
 
+void rpc::server_status()
+{
+    session().load();
+
+    if (loggedIn())
+    {
+        cppcms::json::value v = cppcms::json::object();
+        cppcms::json::object& obj = v.object();
+
+        // In bytes, a limit of 0 means no limit
+        obj["memory"] = p.memoryUsage();
+        obj["memoryLimit"] = p.memoryLimit();
+
+        return_result(v);
+    }
+    else
+    {
+        return_error("not logged in");
+    }
+}
+
 bool rpc::loggedIn()
 {
     if (session().is_set("loggedIn") && session().get<bool>("loggedIn") &&
@@ -334,38 +384,75 @@ void rpc::on_timer(const booster::system::error_code& e)
     int timeout = 300; // 5 min
 
     // Remove really old connections
-    std::unique_lock<std::mutex> lock(waiters_mutex);
+    std::vector<std::pair<long long, ProcessRequest>> expired;
 
-    for (std::vector<ProcessRequest>::iterator i = waiters.begin();
-            i != waiters.end(); ++i)
     {
-        if (time(NULL) - i->createTime > timeout)
-        {
-            i->call->return_error("Connection closed by server");
-            i = waiters.erase(i);
+        std::unique_lock<std::mutex> lock(waiters_mutex);
 
-            if (i == waiters.end())
-                break;
+        for (std::unordered_map<long long, ProcessRequest>::iterator i = waiters.begin();
+                i != waiters.end(); )
+        {
+            if (time(NULL) - i->second.createTime > timeout)
+            {
+                expired.push_back(*i);
+                i = waiters.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
         }
     }
 
+    // Don't hold our lock when unsubscribing since the status callbacks are
+    // called with the channel locked
+    for (std::pair<long long, ProcessRequest>& w : expired)
+    {
+        p.statusUnsubscribe(w.second.formId, w.first);
+        w.second.call->return_error("Connection closed by server");
+    }
+
     // Restart timer
     timer.expires_from_now(booster::ptime::seconds(30));
     timer.async_wait(boost::bind(&rpc::on_timer, booster::intrusive_ptr<rpc>(this), _1));
 }
 
-void rpc::remove_context(booster::shared_ptr<cppcms::rpc::json_call> call)
+void rpc::remove_context(long long subscription)
 {
-    std::unique_lock<std::mutex> lock(waiters_mutex);
-    std::vector<ProcessRequest>::iterator i = std::find_if(
-            waiters.begin(), waiters.end(), RequestCallPredicate(call));
+    long long formId;
+
+    {
+        std::unique_lock<std::mutex> lock(waiters_mutex);
+        std::unordered_map<long long, ProcessRequest>::iterator i =
+            waiters.find(subscription);
 
-    if (i != waiters.end())
+        if (i == waiters.end())
+            return;
+
+        formId = i->second.formId;
         waiters.erase(i);
+    }
+
+    p.statusUnsubscribe(formId, subscription);
 }
 
-void rpc::broadcast(long long formId, int percentage)
+void rpc::broadcast(long long subscription, long long formId, int percentage)
 {
+    booster::shared_ptr<cppcms::rpc::json_call> call;
+
+    {
+        std::unique_lock<std::mutex> lock(waiters_mutex);
+        std::unordered_map<long long, ProcessRequest>::iterator i =
+            waiters.find(subscription);
+
+        // Already timed out or the connection was closed
+        if (i == waiters.end())
+            return;
+
+        call = i->second.call;
+        waiters.erase(i);
+    }
+
     cppcms::json::value v = cppcms::json::object();
     cppcms::json::object& obj = v.object();
 
@@ -373,65 +460,30 @@ void rpc::broadcast(long long formId, int percentage)
     obj["id"] = formId;
     obj["percent"] = percentage;
 
-    std::unique_lock<std::mutex> lock(waiters_mutex);
-
-    for (std::vector<ProcessRequest>::iterator i = waiters.begin();
-            i != waiters.end(); ++i)
-    {
-        if (i->formId == formId)
-        {
-            i->call->return_result(v);
-
-            // Remove this under the assumption that there is only one request
-            // per formId
-            waiters.erase(i);
-            break;
-        }
-    }
+    call->return_result(v);
 }
 
-void StatusThread::operator()()
+void rpc::broadcastTo(const std::shared_ptr<Alive>& alive,
+    long long subscription, long long formId, int percentage)
 {
-    while (!exiting)
-    {
-        std::vector<Status> results = parent.p.statusWait();
+    std::unique_lock<std::mutex> lock(alive->lock);
 
-        if (exiting)
-            break;
-
-        for (Status& s : results)
-            parent.broadcast(s.formId, s.percentage);
-    }
+    if (alive->self)
+        alive->self->broadcast(subscription, formId, percentage);
 }
 
-// See: http://stackoverflow.com/q/13784434/2698494
 std::string rpc::sha256(const std::string& s) const
 {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, s.c_str(), s.size());
-    SHA256_Final(hash, &sha256);
-
-    std::ostringstream ss;
-
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-
-    return ss.str();
+    return ::sha256(s.c_str(), s.size());
 }
 
 std::string rpc::genSalt()
 {
     int size = 32;
-    std::ostringstream ss;
     std::vector<unsigned char> salt(size, 0);
     urand.generate(&salt[0], size);
 
-    for (int i = 0; i < size; i++)
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)salt[i];
-
-    return ss.str();
+    return hex(salt.data(), salt.size());
 }
 
 // See: http://stackoverflow.com/a/236803/2698494
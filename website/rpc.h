@@ -5,12 +5,11 @@
 #ifndef H_RPC
 #define H_RPC
 
-#include <set>
 #include <ctime>
 #include <mutex>
-#include <atomic>
-#include <thread>
+#include <memory>
 #include <vector>
+#include <unordered_map>
 #include <cppcms/urandom.h>
 #include <cppcms/service.h>
 #include <cppcms/rpc_json.h>
@@ -20,7 +19,7 @@
 #include "../processor.h"
 
 // Store both a request for a status update on a particular form and the ID of
-// that form so we know which status update to give to which request
+// that form so we can unsubscribe if it times out
 struct ProcessRequest
 {
     time_t createTime;
@@ -36,20 +35,28 @@ struct ProcessRequest
 
 class rpc : public cppcms::rpc::json_rpc_server
 {
+    // Shared with the replies to status updates so they can tell whether
+    // we're still around without keeping us alive, cleared before we're
+    // destroyed
+    struct Alive
+    {
+        std::mutex lock;
+        rpc* self;
+
+        explicit Alive(rpc* self) : self(self) { }
+    };
+
     Database& db;
     Processor& p;
+    const std::shared_ptr<Alive> alive;
 
-    // Long polling requests
+    // Long polling requests by their subscription ID
     std::mutex waiters_mutex;
-    std::vector<ProcessRequest> waiters;
+    std::unordered_map<long long, ProcessRequest> waiters;
 
     // Timer for reseting really long requests
     booster::aio::deadline_timer timer;
 
-    // Monitor processing statuses
-    std::atomic_bool exiting;
-    std::thread statusThread;
-
     // For generating password salts
     cppcms::urandom_device urand;
 
@@ -67,6 +74,7 @@ public:
     void form_getall();
     void form_delete(long long formId);
     void form_rename();
+    void server_status();
 
 private:
     bool login(const std::string& user, const std::string& pass);
@@ -78,10 +86,14 @@ private:
 
     // Remove really old long polling requests
     void on_timer(const booster::system::error_code& e);
-    void remove_context(booster::shared_ptr<cppcms::rpc::json_call> call);
+    void remove_context(long long subscription);
+
+    // Reply to the request with this subscription, called in the event loop
+    void broadcast(long long subscription, long long formId, int percentage);
 
-    // If this form is currently being waited on, then send the status update
-    void broadcast(long long formId, int percentage);
+    // Same, if we haven't been destroyed yet
+    static void broadcastTo(const std::shared_ptr<Alive>& alive,
+        long long subscription, long long formId, int percentage);
 
     // For passwords using OpenSSL
     std::string sha256(const std::string& s) const;
@@ -104,57 +116,6 @@ private:
     bool passCorrect(const std::string& correctPass,
         const std::string& inputPass) const;
 
-    friend class StatusThread;
-};
-
-// Thread to monitor status updates, it blocks till Processor says another form
-// has been processed and then calls broadcast() on each of the updates
-class StatusThread
-{
-    rpc& parent;
-    std::atomic_bool& exiting;
-
-public:
-    StatusThread(rpc& parent, std::atomic_bool& exiting)
-        : parent(parent), exiting(exiting)
-    {
-    }
-
-    void operator()();
-};
-
-// For search through the list of waiting requests
-class RequestCallPredicate
-{
-    booster::shared_ptr<cppcms::rpc::json_call> call;
-
-public:
-    RequestCallPredicate(
-            booster::shared_ptr<cppcms::rpc::json_call> call)
-        : call(call)
-    {
-    }
-
-    bool operator()(const ProcessRequest& r)
-    {
-        return r.call == call;
-    }
-};
-
-class RequestIdPredicate
-{
-    long long id;
-
-public:
-    RequestIdPredicate(long long id)
-        : id(id)
-    {
-    }
-
-    bool operator()(const ProcessRequest& r)
-    {
-        return r.formId == id;
-    }
 };
 
 #endif
@@ -91,10 +91,15 @@ void website::forms()
 
         if (key >= 0)
         {
-            if (uploadFile(key) > 0)
+            int retryAfter = 0;
+
+            if (uploadFile(key, retryAfter) > 0)
                 c.message = "Processing, please reload this page in a few minutes.";
+            else if (retryAfter > 0)
+                c.message = "Too many forms are being processed, please try again in " +
+                    std::to_string(retryAfter) + " seconds.";
             else
-                c.message = "Invalid form, not a PDF or too large.";
+                c.message = "Invalid form, not a PDF, TIFF, PNG, or JPEG or too large.";
         }
     }
 
@@ -117,13 +122,22 @@ void website::upload(std::string num)
 
         if (key >= 0 && request().request_method() == "POST")
         {
-            long long id = uploadFile(key);
+            int retryAfter = 0;
+            long long id = uploadFile(key, retryAfter);
 
             if (id > 0)
             {
                 response().out() << id;
                 return;
             }
+
+            if (retryAfter > 0)
+            {
+                response().status(cppcms::http::response::service_unavailable);
+                response().set_header("Retry-After", std::to_string(retryAfter));
+                response().out() << "busy " << retryAfter;
+                return;
+            }
         }
     }
 
@@ -162,32 +176,51 @@ void website::csv(std::string num)
     response().out() << "Error: please login";
 }
 
-long long website::uploadFile(long long key)
+long long website::uploadFile(long long key, int& retryAfter)
 {
     long long userId = session().get<long long>("id");
 
     for (booster::shared_ptr<cppcms::http::file> file : request().files())
     {
-        // Get lowercase last three letters, the extension, which should be "pdf"
-        if (file->filename().length() <= 3)
-            continue;
+        // Get the lowercase extension, which should be that of a PDF or a
+        // scan saved as an image
+        const std::string::size_type dot = file->filename().rfind('.');
+        std::string ext;
+
+        if (dot != std::string::npos)
+            ext = file->filename().substr(dot + 1);
 
-        std::string ext = file->filename().substr(file->filename().length() - 3);
         std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
 
-        if (file->name() == "file" && (file->mime() == "application/pdf" ||
-            ext == "pdf") && file->size() < maxFilesize)
+        if (ext == "tiff")
+            ext = "tif";
+        else if (ext == "jpeg")
+            ext = "jpg";
+
+        // Saved with the extension, but what it is comes from its contents
+        if (ext != "pdf" && ext != "tif" && ext != "png" && ext != "jpg" &&
+            file->mime() == "application/pdf")
+            ext = "pdf";
+
+        if (file->name() == "file" && (ext == "pdf" || ext == "tif" ||
+            ext == "png" || ext == "jpg") && file->size() < maxFilesize)
         {
+            // Don't even save it if we have too much to do already
+            const Admission admission = p.admit(file->size(), retryAfter);
+
+            if (admission == Admission::Busy)
+                return -1;
+
             // Add to database
             long long id = db.initForm(file->filename(), userId, key, date.getDate());
 
             // Save to disk
             std::ostringstream s;
-            s << "./uploads/" << id << ".pdf";
+            s << "./uploads/" << id << "." << ext;
             file->save_to(s.str());
 
             // Start processing
-            p.add(id, key, s.str());
+            p.add(id, key, s.str(), admission == Admission::Defer);
             return id;
         }
     }
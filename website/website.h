@@ -49,7 +49,10 @@ public:
 
     // Used on the forms page to submit the uploaded file via Javascript
     void upload(std::string num);
-    long long uploadFile(long long key);
+
+    // Save and start processing the uploaded file, returning its ID or -1.
+    // If we're too busy, retryAfter is set to how many seconds to wait.
+    long long uploadFile(long long key, int& retryAfter);
 
     // Download the CSV file
     void csv(std::string num);
@@ -0,0 +1,179 @@
+/*
+ * A lock-free work-stealing deque of pointers (Chase-Lev)
+ *
+ * The owning thread pushes and pops at the bottom, other threads steal from
+ * the top. Only the owner may call push() and pop(), anybody may call steal().
+ * Based on: "Correct and Efficient Work-Stealing for Weak Memory Models," Lê,
+ * Pop, Cohen, and Zappa Nardelli, PPoPP 2013.
+ *
+ * Example:
+ *
+ *   WorkDeque<Item> d;
+ *   d.push(&item);      // owner
+ *   Item* i = d.pop();  // owner, nullptr if empty
+ *   Item* j = d.steal(); // anybody, nullptr if empty or lost a race
+ */
+
+#ifndef H_WORKDEQUE
+#define H_WORKDEQUE
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+template<class Item> class WorkDeque
+{
+    // Circular array that we replace with a larger one when full
+    class Array
+    {
+        long long mask;
+        std::unique_ptr<std::atomic<Item*>[]> items;
+
+    public:
+        Array(long long size)
+            : mask(size-1), items(new std::atomic<Item*>[size])
+        {
+        }
+
+        long long size() const { return mask+1; }
+
+        Item* get(long long i) const
+        {
+            return items[i&mask].load(std::memory_order_relaxed);
+        }
+
+        void put(long long i, Item* item)
+        {
+            items[i&mask].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    std::atomic<long long> top;
+    std::atomic<long long> bottom;
+    std::atomic<Array*> array;
+
+    // Thieves may still be reading an old array after we grow, so keep them
+    // all around until the deque is destroyed. Only the owner touches this.
+    std::vector<std::unique_ptr<Array>> arrays;
+
+public:
+    // Size must be a power of two
+    WorkDeque(long long size = 64);
+
+    WorkDeque(const WorkDeque&) = delete;
+    WorkDeque& operator=(const WorkDeque&) = delete;
+
+    // Owner only
+    void push(Item* item);
+    Item* pop();
+
+    // Any thread
+    Item* steal();
+
+    // Approximate, may be out of date by the time you use it
+    bool empty() const;
+
+private:
+    Array* grow(Array* a, long long b, long long t);
+};
+
+template<class Item> WorkDeque<Item>::WorkDeque(long long size)
+    : top(0), bottom(0)
+{
+    arrays.push_back(std::unique_ptr<Array>(new Array(size)));
+    array.store(arrays.back().get(), std::memory_order_relaxed);
+}
+
+template<class Item> void WorkDeque<Item>::push(Item* item)
+{
+    const long long b = bottom.load(std::memory_order_relaxed);
+    const long long t = top.load(std::memory_order_acquire);
+    Array* a = array.load(std::memory_order_relaxed);
+
+    if (b - t > a->size() - 1)
+        a = grow(a, b, t);
+
+    a->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b+1, std::memory_order_relaxed);
+}
+
+template<class Item> Item* WorkDeque<Item>::pop()
+{
+    const long long b = bottom.load(std::memory_order_relaxed) - 1;
+    Array* a = array.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long t = top.load(std::memory_order_relaxed);
+
+    Item* item = nullptr;
+
+    if (t <= b)
+    {
+        item = a->get(b);
+
+        // Last item, race against the thieves for it
+        if (t == b)
+        {
+            if (!top.compare_exchange_strong(t, t+1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed))
+                item = nullptr;
+
+            bottom.store(b+1, std::memory_order_relaxed);
+        }
+    }
+    else
+    {
+        // Was empty
+        bottom.store(b+1, std::memory_order_relaxed);
+    }
+
+    return item;
+}
+
+template<class Item> Item* WorkDeque<Item>::steal()
+{
+    long long t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const long long b = bottom.load(std::memory_order_acquire);
+
+    if (t < b)
+    {
+        // Consume ordering isn't really implemented anywhere, so use acquire
+        Array* a = array.load(std::memory_order_acquire);
+        Item* item = a->get(t);
+
+        // Somebody else (the owner or another thief) got it first
+        if (!top.compare_exchange_strong(t, t+1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+
+        return item;
+    }
+
+    return nullptr;
+}
+
+template<class Item> bool WorkDeque<Item>::empty() const
+{
+    const long long b = bottom.load(std::memory_order_relaxed);
+    const long long t = top.load(std::memory_order_relaxed);
+
+    return b <= t;
+}
+
+template<class Item> typename WorkDeque<Item>::Array* WorkDeque<Item>::grow(
+        Array* a, long long b, long long t)
+{
+    Array* bigger = new Array(a->size()*2);
+
+    for (long long i = t; i < b; ++i)
+        bigger->put(i, a->get(i));
+
+    arrays.push_back(std::unique_ptr<Array>(bigger));
+    array.store(bigger, std::memory_order_release);
+
+    return bigger;
+}
+
+#endif